@@ -28,17 +28,78 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 // Oscillator Frequency.
 #define	_XTAL_FREQ		8000000		//using internal osc
 
+// HD44780 execution time in us, 37us and 1.52ms at 270kHz plus margin
+#define LCD_T_EXEC_US	40
+#define LCD_T_HOME_US	1640
+// E pulse must stay high at least 230ns, one instruction cycle at 8MHz
+#if _XTAL_FREQ > 8000000
+#define LCD_E_DELAY()	NOP()
+#else
+#define LCD_E_DELAY()
+#endif
+
+// Timer 0 interrupt every 1ms, prescaler 1:8
+#define TMR0_PS			0b010
+#define TMR0_RELOAD		(256 - _XTAL_FREQ / 4 / 8 / 1000)
+
+// Buzzer patterns, played by the Timer 0 interrupt
+#define BEEP_MS			50			// on and off time of beep()
+#define BEEP_QUEUE		4			// patterns waiting, must be a power of 2
+
+// PWM period, 8 bit duty cycle of PWM_PR2 + 1 is 100%
+#define PWM_PR2			0x65
+
+// Control loop heartbeat, Timer 2 postscaler interrupt every CONTROL_POSTSCALE
+// PWM periods. Timer 1 counts Fosc/4 from each heartbeat for the loop time.
+#define CONTROL_POSTSCALE	10			// 1 to 16, 10 x 204us = 2.04ms at 8MHz
+#define CONTROL_PERIOD_T1	((PWM_PR2 + 1) * 4 * CONTROL_POSTSCALE)	// Timer 1 counts, Timer 2 prescale is 4
+#define CONTROL_PER_SECOND	(_XTAL_FREQ / 4 / CONTROL_PERIOD_T1)
+
 // UART baud rate
-#define UART_BAUD		9600
+#define UART_BAUD		9600		// must match the SKPS baud rate jumper; 38400, 57600 and 115200 also fit the 8MHz clock
+#define UART_MAX_ERROR	25			// maximum baud rate error in 0.1%, the build fails above this
+
+// Baud rate generator, selected at compile time. With BRG16 = 1 and BRGH = 1
+// the baud rate is Fosc / (4 * (SPBRG + 1)), this is the finest divisor so
+// it always has the lowest error. BRGH = 0 is only needed for very low baud rates.
+// UART_BAUD * div is taken in unsigned long, in a 16-bit int 9600 * 4 overflows.
+#define UART_SPBRG_DIV(div)	((_XTAL_FREQ + UART_BAUD * 1UL * (div) / 2) / (UART_BAUD * 1UL * (div)) - 1)
+#if UART_SPBRG_DIV(4) <= 65535
+#define UART_BRGH		1
+#define UART_DIV		4
+#else
+#define UART_BRGH		0
+#define UART_DIV		16
+#endif
+#define UART_SPBRG		UART_SPBRG_DIV(UART_DIV)
+#define UART_ACTUAL		(_XTAL_FREQ / (UART_DIV * (UART_SPBRG + 1)))
+#define UART_ERROR		(((UART_ACTUAL > UART_BAUD) ? (UART_ACTUAL - UART_BAUD) : (UART_BAUD - UART_ACTUAL)) * 1000 / UART_BAUD)
+#if UART_SPBRG < 0 || UART_SPBRG > 65535
+#error "UART_BAUD is out of range for _XTAL_FREQ"
+#elif UART_ERROR > UART_MAX_ERROR
+#error "UART_BAUD error is too high for _XTAL_FREQ"
+#endif
+// UART ring buffer size, must be a power of 2
+#define UART_RX_SIZE	16
+#define UART_TX_SIZE	16
+#if (UART_RX_SIZE & (UART_RX_SIZE - 1)) || (UART_TX_SIZE & (UART_TX_SIZE - 1))
+#error "UART buffer size must be a power of 2"
+#endif
 
 // I/O Connections.
 // Parallel 2x16 Character LCD
 #define LCD_E			RE2		// E clock pin is connected to RB5	
-#define LCD_RS			RB6		// RS pin is used for LCD to differentiate data is command or character
+#define PORTB_LCD_RS	0b01000000	// RB6, RS pin is used for LCD to differentiate data is command or character
 #define	LCD_DATA		PORTD	// Data port of LCD is connected to PORTD, 4 bit mode								
+//#define LCD_RW		RC3		// LCD R/W pin, set as output, if connected: poll the busy flag
+#define LCD_DATA_TRIS	TRISD
+#define LCD_BUSY		RD7		// busy flag, DB7
+#define LCD_ROWS		2		// 2x8 LCD, frame buffer size
+#define LCD_COLS		8
+#define LCD_SIZE		(LCD_ROWS * LCD_COLS)
 
 // LED on MC40A
-#define LED1			RB7
+#define PORTB_LED1		0b10000000	// RB7
 
 // Push button on MC40A
 #define SW1				RB0		
@@ -49,17 +110,33 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 #define LIMIT2			RA2		//limit switch 2
 
 // Buzzer
-#define BUZZER			RB7
+#define PORTB_BUZZER	0b10000000	// RB7, same pin as LED1
 
 // L293B, H-Bridge IC to drive either DC brush or Stepper Motor
 #define ML_EN			RC1		// this pin is connected to Enable of L293 H-bridge driver, it is being use for speed control, for Motor left
 #define MR_EN			RC2		// this pin is connected to Enable of L293 H-bridge driver, it is being use for speed control, for Motor right
 
-// L293 pin for DC Brushed Motor
-#define MR_1			RB2		//right motor pin 1
-#define MR_2			RB3		//right motor pin 2
-#define ML_1			RB4		//left motor pin 1
-#define ML_2			RB5		//left motor pin 2
+// L293 pin for DC Brushed Motor, PORTB bits
+#define PORTB_MR_1		0b00000100	// RB2, right motor pin 1
+#define PORTB_MR_2		0b00001000	// RB3, right motor pin 2
+#define PORTB_ML_1		0b00010000	// RB4, left motor pin 1
+#define PORTB_ML_2		0b00100000	// RB5, left motor pin 2
+#define PORTB_MR		(PORTB_MR_1 | PORTB_MR_2)
+#define PORTB_ML		(PORTB_ML_1 | PORTB_ML_2)
+#define PORTB_MOTORS	(PORTB_MR | PORTB_ML)
+
+// Motor directions for portb_write(), 0 is stop
+#define MR_FORWARD		PORTB_MR_1
+#define MR_REVERSE		PORTB_MR_2
+#define MR_BRAKE		PORTB_MR
+#define ML_FORWARD		PORTB_ML_2
+#define ML_REVERSE		PORTB_ML_1
+#define ML_BRAKE		PORTB_ML
+
+// PORTB outputs are written from uc_portb_shadow, every update is a single
+// write of the whole port. portb_write() in the program, PORTB_WRITE_ISR()
+// in the interrupt, which cannot be interrupted itself.
+#define PORTB_WRITE_ISR(mask, value)	(PORTB = uc_portb_shadow = (uc_portb_shadow & ~(mask)) | ((value) & (mask)))
 
 // LSS05 sensor input assignment
 #define SEN1			RA3		
@@ -112,6 +189,16 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 #define p_motor1		29
 #define p_motor2		30
 
+#define SKPS_TIMEOUT_MS	10		// no reply from SKPS after this time
+#define SKPS_NO_REPLY	1		// uc_skps() value on timeout, as a released button
+
+#define SKPS_FIELDS		10		// number of fields in skps_field[], at most UART_TX_SIZE - 1
+#define SKPS_BURST_TIMEOUT_MS	(SKPS_FIELDS * 20000UL / UART_BAUD + 10)	// 2 byte times per field, plus margin
+#if SKPS_FIELDS >= UART_TX_SIZE || SKPS_FIELDS >= UART_RX_SIZE
+#error "SKPS_FIELDS does not fit in the UART buffers"
+#endif
+#define SKPS_RESYNC		0xFF	// uc_skps_received while waiting for the SKPS to be quiet
+
 
 /*******************************************************************************
 * PRIVATE FUNCTION PROTOTYPES                                                  *
@@ -121,6 +208,11 @@ void uart_init(void);
 void uart_tx(unsigned char uc_data);
 unsigned char uc_uart_rx(void);
 void uart_putstr(const char* csz_string);
+void uart_isr(void);
+unsigned char uc_uart_send(unsigned char uc_data);
+unsigned char uc_uart_try_rx(unsigned char* puc_data);
+unsigned char uc_uart_rx_timeout(unsigned char* puc_data, unsigned int ui_timeout_ms);
+void uart_rx_flush(void);
 // ADC functions
 void adc_init(void);
 unsigned int ui_adc_read(void);
@@ -133,6 +225,7 @@ void send_lcd_data(unsigned char b_rs, unsigned char uc_data);
 void set_lcd_e(unsigned char b_output);
 void set_lcd_rs(unsigned char b_output);
 void set_lcd_data(unsigned char uc_data);
+void lcd_wait_busy(void);
 void lcd_init(void);
 void lcd_clr(void);
 void lcd_home(void);
@@ -140,13 +233,28 @@ void lcd_2ndline(void);
 void lcd_goto(unsigned char uc_position);
 void lcd_putchar(char c_data);
 void lcd_putstr(const char* csz_string);
+void lcd_refresh(void);
+// Timer functions
+void timer0_init(void);
+void control_start(void);
+void control_wait(void);
+void control_show_slack(unsigned char uc_position);
 // SKPS functions
 unsigned char uc_skps(unsigned char uc_data);
 void skps_vibrate(unsigned char uc_motor, unsigned char uc_value);
 void skps_reset(void);
+void skps_request(void);
+unsigned char uc_skps_update(void);
+unsigned char uc_skps_get(unsigned char uc_field);
+void skps_show_rate(unsigned char uc_rate);
 
 void delay_ms(unsigned int ui_value);
+void portb_write(unsigned char uc_mask, unsigned char uc_value);
 void beep(unsigned char uc_count);
+unsigned char beep_pattern(unsigned char uc_count, unsigned int ui_on_ms, unsigned int ui_off_ms);
+unsigned char beep_busy(void);
+void beep_wait(void);
+void beep_isr(void);
 void SKPS_control(void);
 // functions for line following
 void motor(unsigned char uc_left_motor_speed,unsigned char uc_right_motor_speed);
@@ -155,6 +263,53 @@ void motor(unsigned char uc_left_motor_speed,unsigned char uc_right_motor_speed)
 /*******************************************************************************
 * Global Variables                                                             *
 *******************************************************************************/
+// LCD frame buffer, lcd_buffer[] is what the program wants on the LCD and
+// lcd_shown[] is what the LCD is showing.
+const unsigned char lcd_row_address[4] = {0x00, 0x40, 0x14, 0x54};
+volatile unsigned char lcd_buffer[LCD_SIZE];
+unsigned char lcd_shown[LCD_SIZE];
+unsigned char uc_lcd_cursor, uc_lcd_row_end;	// next lcd_buffer[] character and end of its row
+unsigned char uc_lcd_scan, uc_lcd_address;		// next character to check, LCD address counter
+volatile bit b_lcd_dirty;						// lcd_buffer[] changed since last refresh pass
+
+unsigned char uc_portb_shadow;					// last value written to PORTB
+
+// Buzzer pattern queue, beep_pattern() writes uc_beep_head and the interrupt uc_beep_tail.
+unsigned char beep_count[BEEP_QUEUE];
+unsigned int beep_on_ms[BEEP_QUEUE], beep_off_ms[BEEP_QUEUE];
+volatile unsigned char uc_beep_head, uc_beep_tail;
+volatile unsigned int ui_beep_time;				// ms left of the on or off time
+unsigned char uc_beep_left;						// beeps left of the playing pattern
+unsigned int ui_beep_on, ui_beep_off;			// on and off time of the playing pattern
+bit b_beep_on;									// buzzer is on
+
+// Control loop heartbeat and the duty cycles waiting for it
+volatile unsigned char uc_control_tick;			// +1 every heartbeat in the Timer 2 interrupt
+unsigned char uc_control_last;					// uc_control_tick of the current pass
+unsigned int ui_control_worst;					// longest pass in Timer 1 counts
+unsigned int ui_control_overrun;				// passes longer than the heartbeat
+volatile unsigned char uc_ccpr1l_next, uc_ccpr2l_next;	// duty cycle for the next heartbeat
+volatile bit b_pwmr_next, b_pwml_next;			// new duty cycle waiting
+
+// UART ring buffers, the interrupt writes uc_uart_rx_head and uc_uart_tx_tail.
+volatile unsigned char uart_rx_buffer[UART_RX_SIZE];
+volatile unsigned char uart_tx_buffer[UART_TX_SIZE];
+volatile unsigned char uc_uart_rx_head, uc_uart_rx_tail;
+volatile unsigned char uc_uart_tx_head, uc_uart_tx_tail;
+
+bit b_skps_timeout;		// set by uc_skps() and uc_skps_update() when SKPS does not reply
+
+// Fields requested from SKPS in every burst, the replies come back in the same order.
+const unsigned char skps_field[SKPS_FIELDS] = {
+	p_cross, p_l1, p_l2, p_r1, p_r2, p_joy_ry, p_joy_lx, p_joy_ly, p_circle, p_square
+};
+unsigned char skps_receive[SKPS_FIELDS];		// replies of the burst in progress
+unsigned char skps_snapshot[p_joy_rr + 1];		// last complete burst, indexed by field
+unsigned char uc_skps_received;					// replies received, or SKPS_RESYNC
+unsigned char uc_skps_request_time;				// uc_ms_tick when the burst was sent
+
+volatile unsigned char uc_ms_tick;				// +1 every 1ms in the Timer 0 interrupt
+
 
 char string_buffer[40] = {0};
 char string_SWsError[] = "Other \nSWs Low";
@@ -174,7 +329,8 @@ int main(void)
 	IRCF0 = 1;		// IRCF<2:0> = 101 => 2MHz, PORTA = 0;
 	
 	// clear port value
-	PORTB = 0;
+	uc_portb_shadow = 0;
+	PORTB = uc_portb_shadow;
 	PORTC = 0;
 	PORTD = 0;
 	PORTE = 0;
@@ -197,6 +353,10 @@ int main(void)
 	
 	// Initialize the LCD.
 	lcd_init();		// call this function is 2x8 LCD is connected to MC40A
+	
+	// Initialize Timer 0, the LCD is refreshed from its interrupt.
+	timer0_init();
+	GIE = 1;
 			
 	// Display the messages and beep twice.
 	lcd_clr();
@@ -212,6 +372,48 @@ int main(void)
 }
 
 
+/*******************************************************************************
+* INTERRUPT SERVICE ROUTINE                                                    *
+*******************************************************************************/
+void interrupt isr(void)
+{
+	// Timer 2 postscaler, the control loop heartbeat.
+	if (TMR2IE == 1 && TMR2IF == 1) {
+		TMR2IF = 0;
+		TMR1L = 0;		// Timer 1 counts from the heartbeat, low byte first
+		TMR1H = 0;		// so it cannot carry into the high byte
+		uc_control_tick++;
+		
+		// Apply new duty cycles at the start of a PWM period, so both bytes
+		// are latched together and every update has the same delay.
+		if (b_pwmr_next == 1) {
+			CCPR1L = uc_ccpr1l_next;
+			b_pwmr_next = 0;
+		}
+		if (b_pwml_next == 1) {
+			CCPR2L = uc_ccpr2l_next;
+			b_pwml_next = 0;
+		}
+	}
+	
+	// Timer 0 overflow, every 1ms.
+	if (T0IE == 1 && T0IF == 1) {
+		T0IF = 0;
+		TMR0 += TMR0_RELOAD;
+		uc_ms_tick++;
+		
+		// Next step of the buzzer pattern.
+		beep_isr();
+		
+		// Send one changed character to the LCD.
+		lcd_refresh();
+	}
+	
+	// UART receive and transmit.
+	uart_isr();
+}
+
+
 
 /*******************************************************************************
 * PRIVATE FUNCTION: delay_ms
@@ -234,6 +436,34 @@ void delay_ms(unsigned int ui_value)
 }	
 
 
+/*******************************************************************************
+* PRIVATE FUNCTION: portb_write
+*
+* PARAMETERS:
+* ~ uc_mask		- PORTB bits to change.
+* ~ uc_value	- New value of those bits.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Update the masked bits of uc_portb_shadow and write it to PORTB at once,
+* instead of a read-modify-write of the port for every pin. The interrupt
+* writes LCD RS and the buzzer through the shadow too, so it is held off
+* while the shadow is updated.
+*
+*******************************************************************************/
+void portb_write(unsigned char uc_mask, unsigned char uc_value)
+{
+	unsigned char uc_gie = GIE;
+	
+	GIE = 0;
+	uc_portb_shadow = (uc_portb_shadow & ~uc_mask) | (uc_value & uc_mask);
+	PORTB = uc_portb_shadow;
+	GIE = uc_gie;
+}
+
+
 
 /*******************************************************************************
 * PRIVATE FUNCTION: beep
@@ -245,17 +475,142 @@ void delay_ms(unsigned int ui_value)
 * ~ void
 *
 * DESCRIPTIONS:
-* Beep for the specified number of times.
+* Beep for the specified number of times, returns without waiting for it.
 *
 *******************************************************************************/
 void beep(unsigned char uc_count)
 {
-	while (uc_count-- > 0) {
-		BUZZER = 1;
-		delay_ms(50);
-		BUZZER = 0;
-		delay_ms(50);
+	beep_pattern(uc_count, BEEP_MS, BEEP_MS);
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_pattern
+*
+* PARAMETERS:
+* ~ uc_count	- How many beeps.
+* ~ ui_on_ms	- Buzzer on time of each beep in miliseconds.
+* ~ ui_off_ms	- Buzzer off time after each beep in miliseconds.
+*
+* RETURN:
+* ~ 1 if the pattern is queued, 0 if the queue is full and it is dropped.
+*
+* DESCRIPTIONS:
+* Queue a beep pattern and return at once, the Timer 0 interrupt plays the
+* queued patterns one after the other. LED1 shares the pin, wait for
+* beep_busy() to return 0 before writing PORTB_BUZZER or PORTB_LED1.
+*
+*******************************************************************************/
+unsigned char beep_pattern(unsigned char uc_count, unsigned int ui_on_ms, unsigned int ui_off_ms)
+{
+	unsigned char uc_next = (uc_beep_head + 1) & (BEEP_QUEUE - 1);
+	
+	if (uc_next == uc_beep_tail || uc_count == 0) {
+		return 0;
+	}
+	
+	beep_count[uc_beep_head] = uc_count;
+	beep_on_ms[uc_beep_head] = ui_on_ms;
+	beep_off_ms[uc_beep_head] = ui_off_ms;
+	uc_beep_head = uc_next;		// written last, the interrupt may take it at once
+	return 1;
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_busy
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ 1 while a pattern is playing or queued, else 0.
+*
+* DESCRIPTIONS:
+* Check whether the buzzer is still in use by the queued patterns.
+* ui_beep_time is two bytes written by the Timer 0 interrupt, so it is
+* held off while they are read.
+*
+*******************************************************************************/
+unsigned char beep_busy(void)
+{
+	unsigned char uc_t0ie = T0IE;
+	unsigned char uc_busy;
+	
+	T0IE = 0;
+	uc_busy = (ui_beep_time != 0 || uc_beep_tail != uc_beep_head);
+	T0IE = uc_t0ie;
+	return uc_busy;
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_wait
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Wait until all the queued patterns are played.
+*
+*******************************************************************************/
+void beep_wait(void)
+{
+	while (beep_busy() == 1);
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_isr
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Called every 1ms by the Timer 0 interrupt. Counts down the on or off time
+* and switches the buzzer, then takes the next pattern from the queue.
+*
+*******************************************************************************/
+void beep_isr(void)
+{
+	if (ui_beep_time != 0 && --ui_beep_time != 0) {
+		return;
 	}
+	
+	// On time over, off for the rest of this beep.
+	if (b_beep_on == 1) {
+		PORTB_WRITE_ISR(PORTB_BUZZER, 0);
+		b_beep_on = 0;
+		ui_beep_time = ui_beep_off;
+		if (ui_beep_time != 0) {
+			return;
+		}
+	}
+	
+	// Off time over, next beep of this pattern or the next pattern.
+	if (uc_beep_left == 0) {
+		if (uc_beep_tail == uc_beep_head) {
+			return;
+		}
+		uc_beep_left = beep_count[uc_beep_tail];
+		ui_beep_on = beep_on_ms[uc_beep_tail];
+		ui_beep_off = beep_off_ms[uc_beep_tail];
+		uc_beep_tail = (uc_beep_tail + 1) & (BEEP_QUEUE - 1);
+	}
+	uc_beep_left--;
+	PORTB_WRITE_ISR(PORTB_BUZZER, PORTB_BUZZER);
+	b_beep_on = 1;
+	ui_beep_time = ui_beep_on;
 }
 
 /*******************************************************************************
@@ -276,6 +631,9 @@ void SKPS_control(void)
 {
 	unsigned char uc_skps_ly = 0 , uc_skps_lx = 0, uc_skps_ry = 0;
 	unsigned char max_speed = 40;
+	unsigned char uc_vibrate1 = 0, uc_vibrate2 = 0;
+	unsigned char uc_rate = 0, uc_last_tick;
+	unsigned int ui_rate_ms = 0;
 	// Display the messages.
 	lcd_clr();
 	lcd_putstr("  Demo\n  SKPS");
@@ -297,44 +655,65 @@ void SKPS_control(void)
 	lcd_clr();
 	lcd_putstr("  PS2\nConnect!");
 	
+	// Request all the fields at once, the replies are collected by uc_skps_update().
+	skps_request();
+	uc_last_tick = uc_ms_tick;
+	control_start();
 	
-	while (uc_skps(p_cross)==1) 
+	while (1) 
 	{	
-		if(!(uc_skps(p_l1) && uc_skps(p_l2) && uc_skps(p_r1) && uc_skps(p_r2)))
+		// One pass every control heartbeat.
+		control_wait();
+		
+		// Count the loop rate, show it and the loop slack once every second.
+		ui_rate_ms += (unsigned char)(uc_ms_tick - uc_last_tick);
+		uc_last_tick += (unsigned char)(uc_ms_tick - uc_last_tick);
+		if (ui_rate_ms >= 1000) {
+			ui_rate_ms -= 1000;
+			skps_show_rate(uc_rate);
+			control_show_slack(0x00);
+			uc_rate = 0;
+		}
+		
+		// Wait for a complete snapshot of the controller.
+		if (uc_skps_update() == 0) {
+			// SKPS did not reply, stop the motors until it does.
+			if (b_skps_timeout == 1) {
+				b_skps_timeout = 0;
+				motor(0, 0);
+			}
+			continue;
+		}
+		if (uc_rate < 255) uc_rate++;
+		
+		if (uc_skps_get(p_cross) == 0) break;	// cross is pressed, exit
+		
+		if(!(uc_skps_get(p_l1) && uc_skps_get(p_l2) && uc_skps_get(p_r1) && uc_skps_get(p_r2)))
 		{			
-			BUZZER = 1;
+			portb_write(PORTB_BUZZER, PORTB_BUZZER);
 		}	
 		else 
 		{
-			BUZZER = 0;		
+			portb_write(PORTB_BUZZER, 0);		
 		}
 		
-		uc_skps_ry = uc_skps(p_joy_ry);		// read the value of right joystik, y axis
-		uc_skps_lx = uc_skps(p_joy_lx);		// read the value of left joystick, x axis
-		uc_skps_ly = uc_skps(p_joy_ly);		// read the value of left joystick, y axis
+		uc_skps_ry = uc_skps_get(p_joy_ry);		// read the value of right joystik, y axis
+		uc_skps_lx = uc_skps_get(p_joy_lx);		// read the value of left joystick, x axis
+		uc_skps_ly = uc_skps_get(p_joy_ly);		// read the value of left joystick, y axis
 		
 		if(uc_skps_ly < 100)  //left joystick being push up
 		{
 			if(uc_skps_lx < 100) // left joystick being push left
 			{
-			ML_1 = 0;	// left motor stop
-			ML_2 = 0;
-			MR_1 = 1;	// right motor forward
-			MR_2 = 0;
+			portb_write(PORTB_MOTORS, MR_FORWARD);	// left motor stop
 			}
 			else if (uc_skps_lx > 156)// left joystick being push right
 			{
-			ML_1 = 0;	// left motor forward
-			ML_2 = 1;
-			MR_1 = 0;	// right motor stop
-			MR_2 = 0;
+			portb_write(PORTB_MOTORS, ML_FORWARD);	// right motor stop
 			}
 			else
 			{
-			ML_1 = 0;	// left motor forward
-			ML_2 = 1;
-			MR_1 = 1;	// right motor forward
-			MR_2 = 0;
+			portb_write(PORTB_MOTORS, MR_FORWARD | ML_FORWARD);
 			}			
 			
 		}
@@ -342,24 +721,15 @@ void SKPS_control(void)
 		{
 			if(uc_skps_lx < 100) // left joystick being push left
 			{
-			ML_1 = 0;	// left motor stop
-			ML_2 = 0;
-			MR_1 = 0;	// right motor reverse
-			MR_2 = 1;
+			portb_write(PORTB_MOTORS, MR_REVERSE);	// left motor stop
 			}
 			else if (uc_skps_lx > 156)// left joystick being push right
 			{
-			ML_1 = 1;	// left motor reverse
-			ML_2 = 0;
-			MR_1 = 0;	// right motor stop
-			MR_2 = 0;
+			portb_write(PORTB_MOTORS, ML_REVERSE);	// right motor stop
 			}
 			else
 			{
-			ML_1 = 1;	// left motor reverse
-			ML_2 = 0;
-			MR_1 = 0;	// right motor reverse
-			MR_2 = 1;
+			portb_write(PORTB_MOTORS, MR_REVERSE | ML_REVERSE);
 			}			
 		}
 		
@@ -367,24 +737,15 @@ void SKPS_control(void)
 		{
 			if(uc_skps_lx < 100) // left joystick being push left
 			{
-			ML_1 = 1;	// left motor reverse
-			ML_2 = 0;
-			MR_1 = 1;	// right motor forward
-			MR_2 = 0;
+			portb_write(PORTB_MOTORS, MR_FORWARD | ML_REVERSE);
 			}
 			else if (uc_skps_lx > 156)// left joystick being push right
 			{
-			ML_1 = 0;	// left motor forward
-			ML_2 = 1;
-			MR_1 = 0;	// right motor reverse
-			MR_2 = 1;
+			portb_write(PORTB_MOTORS, MR_REVERSE | ML_FORWARD);
 			}
 			else
 			{
-			ML_1 = 1;	// left motor brake
-			ML_2 = 1;
-			MR_1 = 1;	// right motor brake
-			MR_2 = 1;
+			portb_write(PORTB_MOTORS, MR_BRAKE | ML_BRAKE);
 			}			
 		}
 		if(uc_skps_ry < 75) //right joystik being push up
@@ -397,19 +758,26 @@ void SKPS_control(void)
 		}		
 		motor(max_speed, max_speed);	//set the speed for both motor
 	
-		// vibrator motor on PS2 joystick	
-		if (uc_skps(p_circle) == 0)		// if circle is being pressed
+		// vibrator motor on PS2 joystick, only send the command when it changes
+		if (uc_skps_get(p_circle) == 0)		// if circle is being pressed
 		{
-		skps_vibrate (p_motor1, 1);		// send command to vibrate right motor
+		if (uc_vibrate1 != 1) skps_vibrate (p_motor1, uc_vibrate1 = 1);		// send command to vibrate right motor
 		}
-		else skps_vibrate(p_motor1, 0);	// stop motor
+		else if (uc_vibrate1 != 0) skps_vibrate(p_motor1, uc_vibrate1 = 0);	// stop motor
 		
-		if (uc_skps(p_square)== 0)		// if square is being pressed
+		if (uc_skps_get(p_square)== 0)		// if square is being pressed
 		{
-		skps_vibrate (p_motor2, 200);	// send command to vibrate left motor	
+		if (uc_vibrate2 != 200) skps_vibrate (p_motor2, uc_vibrate2 = 200);	// send command to vibrate left motor	
 		}
-		else skps_vibrate(p_motor2, 0);	// stop motor
+		else if (uc_vibrate2 != 0) skps_vibrate(p_motor2, uc_vibrate2 = 0);	// stop motor
 	}	
+	
+	motor(0, 0);
+	if (uc_vibrate1 != 0) skps_vibrate(p_motor1, 0);
+	if (uc_vibrate2 != 0) skps_vibrate(p_motor2, 0);
+	
+	// let the replies of the last burst arrive, uc_skps() flushes them
+	delay_ms(SKPS_BURST_TIMEOUT_MS);
 
 	//wait cross to be released
 	while (uc_skps(p_cross) == 0)continue;	
@@ -438,14 +806,19 @@ void SKPS_control(void)
 *******************************************************************************/
 void uart_init(void)
 {	
-	BRG16 = 0;									// Use 8 bit BRG
-	SPBRGH = 0;
-	BRGH = 1;									// Select high speed baud rate.
-	SPBRG = (_XTAL_FREQ / 16 / UART_BAUD) - 1;	// Configure the baud rate.
+	BRG16 = 1;									// Use 16 bit BRG
+	BRGH = UART_BRGH;							// Baud rate selected at compile time.
+	SPBRGH = UART_SPBRG >> 8;					// Configure the baud rate.
+	SPBRG = UART_SPBRG & 0xFF;
 	SPEN = 1;									// Enable serial port.
 	CREN = 1;									// Enable reception.
 	TXEN = 1;									// Enable transmission.
 	SYNC = 0;									// Asynchronous communication
+	
+	uc_uart_rx_head = uc_uart_rx_tail = 0;		// Empty ring buffers.
+	uc_uart_tx_head = uc_uart_tx_tail = 0;
+	RCIE = 1;									// Receive interrupt, TXIE is set by uc_uart_send().
+	PEIE = 1;
 }
 
 
@@ -460,18 +833,15 @@ void uart_init(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* This function will transmit one byte of data using UART. This is a blocking
-* function, if the transmit buffer is full, we will wait until the
-* data in the buffer has been sent out before we move in the new data.
+* This function will transmit one byte of data using UART. This function only
+* waits if the transmit buffer is full, until the interrupt has sent out
+* enough data to move in the new data.
 *
 *******************************************************************************/
 void uart_tx(unsigned char uc_data)
 {
 	// Wait until the transmit buffer is ready for new data.
-	while (TXIF == 0);
-	
-	// Transmit the data.
-	TXREG = uc_data;
+	while (uc_uart_send(uc_data) == 0);
 }
 
 
@@ -493,18 +863,173 @@ void uart_tx(unsigned char uc_data)
 *******************************************************************************/
 unsigned char uc_uart_rx(void)
 {
-	// If there is overrun error...
-	if (OERR == 1) {
-		// Clear the flag by disable and enable back the reception.
-		CREN = 0;
-		CREN = 1;
-	}	
+	unsigned char uc_data;
 	
 	// Wait until there is data available in the receive buffer.
-	while (RCIF == 0);
+	while (uc_uart_try_rx(&uc_data) == 0);
 	
 	// Return the received data.
-	return RCREG;
+	return uc_data;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uart_isr
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Called from the interrupt. Move received bytes into the receive buffer and
+* the next byte of the transmit buffer into TXREG. When the transmit buffer
+* is empty the transmit interrupt is disabled until uc_uart_send() is called.
+*
+*******************************************************************************/
+void uart_isr(void)
+{
+	unsigned char uc_next;
+	
+	// Receive, RCREG holds up to 2 bytes.
+	while (RCIF == 1) {
+		uc_next = (uc_uart_rx_head + 1) & (UART_RX_SIZE - 1);
+		if (uc_next != uc_uart_rx_tail) {
+			uart_rx_buffer[uc_uart_rx_head] = RCREG;
+			uc_uart_rx_head = uc_next;
+		}
+		else {
+			uc_next = RCREG;	// buffer full, drop the data
+		}
+		
+		// If there is overrun error, clear the flag by disable and enable back the reception.
+		if (OERR == 1) {
+			CREN = 0;
+			CREN = 1;
+		}
+	}
+	
+	// Transmit.
+	if (TXIE == 1 && TXIF == 1) {
+		if (uc_uart_tx_tail != uc_uart_tx_head) {
+			TXREG = uart_tx_buffer[uc_uart_tx_tail];
+			uc_uart_tx_tail = (uc_uart_tx_tail + 1) & (UART_TX_SIZE - 1);
+		}
+		else {
+			TXIE = 0;
+		}
+	}
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_uart_send
+*
+* PARAMETERS:
+* ~ uc_data		- The data that we want to transmit.
+*
+* RETURN:
+* ~ 1 if the data is in the transmit buffer, 0 if the buffer is full.
+*
+* DESCRIPTIONS:
+* Put one byte into the transmit buffer and return immediately.
+*
+*******************************************************************************/
+unsigned char uc_uart_send(unsigned char uc_data)
+{
+	unsigned char uc_next = (uc_uart_tx_head + 1) & (UART_TX_SIZE - 1);
+	
+	if (uc_next == uc_uart_tx_tail) {
+		return 0;
+	}
+	uart_tx_buffer[uc_uart_tx_head] = uc_data;
+	uc_uart_tx_head = uc_next;
+	
+	// Let the interrupt send it.
+	TXIE = 1;
+	return 1;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_uart_try_rx
+*
+* PARAMETERS:
+* ~ puc_data	- Where to store the received data.
+*
+* RETURN:
+* ~ 1 if a byte is received, 0 if the receive buffer is empty.
+*
+* DESCRIPTIONS:
+* Take one byte from the receive buffer and return immediately.
+*
+*******************************************************************************/
+unsigned char uc_uart_try_rx(unsigned char* puc_data)
+{
+	if (uc_uart_rx_tail == uc_uart_rx_head) {
+		return 0;
+	}
+	*puc_data = uart_rx_buffer[uc_uart_rx_tail];
+	uc_uart_rx_tail = (uc_uart_rx_tail + 1) & (UART_RX_SIZE - 1);
+	return 1;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_uart_rx_timeout
+*
+* PARAMETERS:
+* ~ puc_data		- Where to store the received data.
+* ~ ui_timeout_ms	- How long to wait in miliseconds.
+*
+* RETURN:
+* ~ 1 if a byte is received, 0 if nothing is received in time.
+*
+* DESCRIPTIONS:
+* Receive one byte, wait at most ui_timeout_ms for it.
+*
+*******************************************************************************/
+unsigned char uc_uart_rx_timeout(unsigned char* puc_data, unsigned int ui_timeout_ms)
+{
+	unsigned char i;
+	
+	while (uc_uart_try_rx(puc_data) == 0) {
+		if (ui_timeout_ms-- == 0) {
+			return 0;
+		}
+		for (i = 0; i < 10; i++) {
+			if (uc_uart_rx_tail != uc_uart_rx_head) {
+				break;
+			}
+			__delay_us(100);
+		}
+	}
+	return 1;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uart_rx_flush
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Discard everything in the receive buffer.
+*
+*******************************************************************************/
+void uart_rx_flush(void)
+{
+	uc_uart_rx_tail = uc_uart_rx_head;
 }
 
 
@@ -634,11 +1159,12 @@ extern unsigned int ui_adc_read(void)
 void pwm_init(void)
 {
 	// Setting PWM frequency = 4.90KHz at 8MHz OSC Freq
-	PR2 = 0x65;
+	PR2 = PWM_PR2;
 	T2CKPS1 = 0;
 	T2CKPS0 = 1;	// Timer 2 prescale = 4.
 	
 	CCPR1L = 0;		// Duty cycle = 0;
+	T2CON = (T2CON & 0b00000111) | ((CONTROL_POSTSCALE - 1) << 3);	// TOUTPS<3:0>, heartbeat
 	TMR2ON = 1;		// Turn on Timer 2.	
 	
 	//configuration for CCP1CON
@@ -661,6 +1187,12 @@ void pwm_init(void)
 	CCP2M2 = 1;		
 	CCP2M1 = 0;
 	CCP2M0 = 0;	
+	
+	// Heartbeat interrupt, set_pwmr() and set_pwml() need it from now on.
+	T1CON = 0b00000001;		// Timer 1 on, Fosc/4, prescale 1:1
+	TMR2IF = 0;
+	TMR2IE = 1;
+	PEIE = 1;
 }	
 
 
@@ -675,12 +1207,14 @@ void pwm_init(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the duty cycle of the PWM1.
+* Set the duty cycle of the PWM1, written by the Timer 2 interrupt at the
+* next heartbeat, the start of a PWM period.
 *
 *******************************************************************************/
 void set_pwmr(unsigned char uc_duty_cycle)
 {
-	CCPR1L = uc_duty_cycle;
+	uc_ccpr1l_next = uc_duty_cycle;
+	b_pwmr_next = 1;
 }	
 
 /*******************************************************************************
@@ -693,14 +1227,135 @@ void set_pwmr(unsigned char uc_duty_cycle)
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the duty cycle of the PWM2.
+* Set the duty cycle of the PWM2, written by the Timer 2 interrupt at the
+* next heartbeat, the start of a PWM period.
 *
 *******************************************************************************/
 void set_pwml(unsigned char uc_duty_cycle)
 {
-	CCPR2L = uc_duty_cycle;
+	uc_ccpr2l_next = uc_duty_cycle;
+	b_pwml_next = 1;
 }	
 
+// ================================== Timer functions ====================================
+
+/*******************************************************************************
+* PUBLIC FUNCTION: timer0_init
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Initialize Timer 0 to interrupt every 1ms.
+*
+*******************************************************************************/
+void timer0_init(void)
+{
+	// Clock = Fosc/4, prescaler assigned to Timer 0.
+	OPTION_REG = (OPTION_REG & 0b11000000) | TMR0_PS;
+	
+	TMR0 = TMR0_RELOAD;
+	T0IF = 0;
+	T0IE = 1;		// Enable Timer 0 interrupt.
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_start
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Call before a control loop, clears the loop time figures.
+*
+*******************************************************************************/
+void control_start(void)
+{
+	uc_control_last = uc_control_tick;
+	ui_control_worst = 0;
+	ui_control_overrun = 0;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_wait
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Call at the top of a control loop, it returns right after the next heartbeat
+* so every pass starts at the same point of the PWM period. The time of the
+* last pass is read from Timer 1 first and the longest is kept. A pass that
+* missed the heartbeat is counted as an overrun and does not wait.
+*
+*******************************************************************************/
+void control_wait(void)
+{
+	unsigned char uc_high;
+	unsigned int ui_time;
+	
+	do {		// read the high byte again if the low byte carried into it
+		uc_high = TMR1H;
+		ui_time = ((unsigned int)uc_high << 8) | TMR1L;
+	} while (uc_high != TMR1H);
+	
+	if (uc_control_tick != uc_control_last) {
+		ui_control_overrun++;
+	}
+	else {
+		if (ui_time > ui_control_worst) ui_control_worst = ui_time;
+		while (uc_control_tick == uc_control_last) continue;
+	}
+	uc_control_last = uc_control_tick;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_show_slack
+*
+* PARAMETERS:
+* ~ uc_position	- LCD address, 0x00 for the 1st line, 0x40 for the 2nd line.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Display the worst case slack of the control loop, the heartbeat period less
+* the longest pass, eg. "S1480us ". "Overrun " once a pass was too long.
+*
+*******************************************************************************/
+void control_show_slack(unsigned char uc_position)
+{
+	unsigned int ui_slack_us;
+	
+	lcd_goto(uc_position);
+	if (ui_control_overrun != 0) {
+		lcd_putstr("Overrun ");
+		return;
+	}
+	ui_slack_us = (unsigned int)((unsigned long)(CONTROL_PERIOD_T1 - ui_control_worst) * 4000 / (_XTAL_FREQ / 1000));
+	lcd_putchar('S');
+	lcd_putchar(ui_slack_us / 1000 % 10 + '0');
+	lcd_putchar(ui_slack_us / 100 % 10 + '0');
+	lcd_putchar(ui_slack_us / 10 % 10 + '0');
+	lcd_putchar(ui_slack_us % 10 + '0');
+	lcd_putstr("us ");
+}
+
 // ================================== LCD functions ======================================
 
 /*******************************************************************************
@@ -713,14 +1368,19 @@ void set_pwml(unsigned char uc_duty_cycle)
 * ~ void
 *
 * DESCRIPTIONS:
-* Initialize and clear the LCD display.
+* Initialize and clear the LCD display and the LCD frame buffer.
 *
 *******************************************************************************/
 void lcd_init(void)
 {
-	// Set the LCD E pin and wait for the LCD to be ready before we
+	unsigned char i;
+	
+	// Clear the LCD E pin and wait for the LCD to be ready before we
 	// start sending data to it.
-	set_lcd_e(1);
+	set_lcd_e(0);
+#ifdef LCD_RW
+	LCD_RW = 0;
+#endif
 	__delay_ms(15);
 	
 	// Configure the Function Set of the LCD.	
@@ -734,8 +1394,18 @@ void lcd_init(void)
 	// Configure the display on/off control of the LCD.
 	send_lcd_data(0, 0b00001100);
 	
-	// Clear the LCD display.
-	lcd_clr();
+	// Clear the LCD display, the address counter is back to 0.
+	send_lcd_data(0, 0b00000001);
+	
+	// The LCD and the frame buffer are both blank now.
+	for (i = 0; i < LCD_SIZE; i++) {
+		lcd_buffer[i] = ' ';
+		lcd_shown[i] = ' ';
+	}
+	uc_lcd_scan = 0;
+	uc_lcd_address = 0;
+	b_lcd_dirty = 0;
+	lcd_home();
 }
 
 
@@ -750,13 +1420,19 @@ void lcd_init(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* Clear the LCD display and return the cursor to the home position.
+* Clear the LCD frame buffer and return the cursor to the home position.
 *
 *******************************************************************************/
 void lcd_clr(void)
 {
-	// Send the command to clear the LCD display.
-	send_lcd_data(0, 0b00000001);
+	unsigned char i;
+	
+	// Fill the frame buffer with space, lcd_refresh() will update the LCD.
+	for (i = 0; i < LCD_SIZE; i++) {
+		lcd_buffer[i] = ' ';
+	}
+	b_lcd_dirty = 1;
+	lcd_home();
 }
 
 
@@ -776,8 +1452,8 @@ void lcd_clr(void)
 *******************************************************************************/
 void lcd_home(void)
 {
-	// Send the command to return the cursor to the home position.
-	send_lcd_data(0, 0b00000010);
+	uc_lcd_cursor = 0;
+	uc_lcd_row_end = LCD_COLS;
 }
 
 
@@ -797,8 +1473,8 @@ void lcd_home(void)
 *******************************************************************************/
 void lcd_2ndline(void)
 {
-	// Send the command to jump to the second row.
-	send_lcd_data(0, 0b11000000);
+	uc_lcd_cursor = LCD_COLS;
+	uc_lcd_row_end = LCD_COLS * 2;
 }
 
 
@@ -813,13 +1489,34 @@ void lcd_2ndline(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* Jump to the defined position of the LCD display.
+* Jump to the defined position of the LCD display, 0x00 is the 1st character
+* of the 1st row and 0x40 is the 1st character of the 2nd row.
 *
 *******************************************************************************/
 void lcd_goto(unsigned char uc_position)
 {
-	// Send the command to jump to the defined position.
-	send_lcd_data(0, 0b10000000 | uc_position);
+	unsigned char uc_row = 0;
+	unsigned char uc_col = uc_position & 0b00111111;
+	
+	if (uc_position & 0b01000000) {
+		uc_row = 1;
+	}
+	
+	// 3rd and 4th row of a 4 line LCD follow the 1st and 2nd row.
+	if (uc_col >= LCD_COLS) {
+		uc_row += 2;
+		uc_col -= LCD_COLS;
+	}
+	
+	// Position outside the display, drop the characters like the LCD does.
+	if (uc_row >= LCD_ROWS || uc_col >= LCD_COLS) {
+		uc_lcd_cursor = 0;
+		uc_lcd_row_end = 0;
+		return;
+	}
+	
+	uc_lcd_row_end = (uc_row + 1) * LCD_COLS;
+	uc_lcd_cursor = uc_lcd_row_end - LCD_COLS + uc_col;
 }
 
 
@@ -834,13 +1531,16 @@ void lcd_goto(unsigned char uc_position)
 * ~ void
 *
 * DESCRIPTIONS:
-* Display a character on the LCD.
+* Write a character to the LCD frame buffer.
 *
 *******************************************************************************/
 void lcd_putchar(char c_data)
 {
-	// Send the data to display.
-	send_lcd_data(1, (unsigned char)c_data);
+	// Characters past the end of the row are not visible.
+	if (uc_lcd_cursor < uc_lcd_row_end) {
+		lcd_buffer[uc_lcd_cursor++] = (unsigned char)c_data;
+		b_lcd_dirty = 1;
+	}
 }
 
 
@@ -891,7 +1591,10 @@ void lcd_putstr(const char* csz_string)
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the output of the LCD RS pin and data bus.
+* Set the output of the LCD RS pin and data bus, latch it into the LCD and
+* wait for the LCD to execute it. Clear display and return home take
+* LCD_T_HOME_US, everything else LCD_T_EXEC_US. If LCD_RW is defined the
+* busy flag is polled instead.
 *
 *******************************************************************************/
 void send_lcd_data(unsigned char b_rs, unsigned char uc_data)
@@ -901,11 +1604,133 @@ void send_lcd_data(unsigned char b_rs, unsigned char uc_data)
 		set_lcd_rs(b_rs);
 		set_lcd_data(uc_data);
 		
-		// Send a negative e pulse.
+		// Send a positive e pulse, the LCD latches the data on the falling edge.
+		set_lcd_e(1);
+		LCD_E_DELAY();
 		set_lcd_e(0);
-		__delay_ms(2);
+		
+#ifdef LCD_RW
+		lcd_wait_busy();
+#else
+		if (b_rs == 0 && uc_data < 0b00000100) {
+			__delay_us(LCD_T_HOME_US);		// clear display, return home
+		}
+		else {
+			__delay_us(LCD_T_EXEC_US);
+		}
+#endif
+}
+
+
+
+#ifdef LCD_RW
+/*******************************************************************************
+* PRIVATE FUNCTION: lcd_wait_busy
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Poll the LCD busy flag (DB7) until the last instruction is done, give up
+* after about LCD_T_HOME_US in case no LCD is connected.
+*
+*******************************************************************************/
+void lcd_wait_busy(void)
+{
+	unsigned char uc_busy;
+	unsigned char uc_timeout = LCD_T_HOME_US / 10;
+	
+	LCD_DATA_TRIS = 0xFF;		// data bus as input
+	set_lcd_rs(0);
+	LCD_RW = 1;					// read busy flag and address
+	do {
 		set_lcd_e(1);
-		__delay_ms(1);		
+		LCD_E_DELAY();			// data output delay
+		uc_busy = LCD_BUSY;
+		set_lcd_e(0);
+		__delay_us(10);
+	} while (uc_busy == 1 && --uc_timeout > 0);
+	LCD_RW = 0;
+	LCD_DATA_TRIS = 0;			// data bus as output
+}
+#endif
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: lcd_refresh
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Called from the Timer 0 interrupt. Send one byte to the LCD for the next
+* character that differs from the frame buffer: the cursor address first if
+* needed, then the character. The 1ms tick covers the LCD execution time, so
+* there is no delay here. The LCD pins are written directly because
+* send_lcd_data() is also called from the main program.
+*
+*******************************************************************************/
+void lcd_refresh(void)
+{
+	unsigned char i;
+	unsigned char uc_row = 0;
+	unsigned char uc_address;
+	unsigned char uc_data;
+	
+	// Only start a new pass if the frame buffer has been changed.
+	if (uc_lcd_scan == 0) {
+		if (b_lcd_dirty == 0) {
+			return;
+		}
+		b_lcd_dirty = 0;
+	}
+	
+	// Look for the next character that is not shown yet.
+	for (i = uc_lcd_scan; i < LCD_SIZE; i++) {
+		if (lcd_buffer[i] != lcd_shown[i]) {
+			break;
+		}
+	}
+	if (i == LCD_SIZE) {
+		uc_lcd_scan = 0;
+		return;
+	}
+	uc_lcd_scan = i;
+	
+	// DDRAM address of the character.
+	uc_address = i;
+	while (uc_address >= LCD_COLS) {
+		uc_address -= LCD_COLS;
+		uc_row++;
+	}
+	uc_address += lcd_row_address[uc_row];
+	
+	if (uc_address != uc_lcd_address) {
+		// Move the LCD cursor, the character is sent on the next tick.
+		PORTB_WRITE_ISR(PORTB_LCD_RS, 0);
+		LCD_DATA = 0b10000000 | uc_address;
+		uc_lcd_address = uc_address;
+	}
+	else {
+		uc_data = lcd_buffer[i];
+		PORTB_WRITE_ISR(PORTB_LCD_RS, PORTB_LCD_RS);
+		LCD_DATA = uc_data;
+		lcd_shown[i] = uc_data;
+		uc_lcd_address++;
+		uc_lcd_scan++;
+	}
+	
+	// Send a positive e pulse.
+	LCD_E = 1;
+	LCD_E_DELAY();
+	LCD_E = 0;
 }
 
 
@@ -945,7 +1770,7 @@ void set_lcd_e(unsigned char b_output)
 *******************************************************************************/
 void set_lcd_rs(unsigned char b_output)
 {
-	LCD_RS = b_output;
+	portb_write(PORTB_LCD_RS, (b_output == 1) ? PORTB_LCD_RS : 0);
 }
 
 
@@ -980,14 +1805,24 @@ void set_lcd_data(unsigned char uc_data)
 * ~ data received from SKPS, the status 
 *
 * DESCRIPTIONS:
-* request SKPS button and joystick status
+* request SKPS button and joystick status. If SKPS does not reply within
+* SKPS_TIMEOUT_MS, return SKPS_NO_REPLY and set b_skps_timeout.
 *
 *******************************************************************************/
 unsigned char uc_skps(unsigned char uc_data)
 {
+	unsigned char uc_status;
+	
+	// drop late replies of earlier requests
+	uart_rx_flush();
+	
 	// send command to request PS2 status
 	uart_tx(uc_data);
-	return uc_uart_rx();
+	if (uc_uart_rx_timeout(&uc_status, SKPS_TIMEOUT_MS) == 0) {
+		b_skps_timeout = 1;
+		return SKPS_NO_REPLY;
+	}
+	return uc_status;
 }	
 
 
@@ -1033,6 +1868,136 @@ void skps_reset(void)
 	__delay_ms(10);	
 }	
 
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: skps_request
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Queue the request of every field in skps_field[] back to back into the
+* transmit buffer, the replies are collected by uc_skps_update().
+*
+*******************************************************************************/
+void skps_request(void)
+{
+	unsigned char i;
+	
+	// drop late replies of earlier requests
+	uart_rx_flush();
+	
+	for (i = 0; i < SKPS_FIELDS; i++) {
+		uart_tx(skps_field[i]);
+	}
+	uc_skps_received = 0;
+	uc_skps_request_time = uc_ms_tick;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_skps_update
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ 1 if a new snapshot is ready, 0 if not.
+*
+* DESCRIPTIONS:
+* Collect the replies of the burst sent by skps_request(), this function does
+* not wait. When all of them are received, copy them into skps_snapshot[] at
+* once and send the next burst. If the burst is not complete within
+* SKPS_BURST_TIMEOUT_MS, set b_skps_timeout, wait until the SKPS has been quiet
+* for SKPS_BURST_TIMEOUT_MS so late replies are not mixed into the next burst,
+* and send it again.
+*
+*******************************************************************************/
+unsigned char uc_skps_update(void)
+{
+	unsigned char i;
+	unsigned char uc_data;
+	
+	if (uc_skps_received == SKPS_RESYNC) {
+		// Any reply restarts the quiet time.
+		while (uc_uart_try_rx(&uc_data) == 1) {
+			uc_skps_request_time = uc_ms_tick;
+		}
+		if ((unsigned char)(uc_ms_tick - uc_skps_request_time) >= SKPS_BURST_TIMEOUT_MS) {
+			skps_request();
+		}
+		return 0;
+	}
+	
+	while (uc_skps_received < SKPS_FIELDS && uc_uart_try_rx(&uc_data) == 1) {
+		skps_receive[uc_skps_received++] = uc_data;
+	}
+	
+	if (uc_skps_received == SKPS_FIELDS) {
+		for (i = 0; i < SKPS_FIELDS; i++) {
+			skps_snapshot[skps_field[i]] = skps_receive[i];
+		}
+		skps_request();
+		return 1;
+	}
+	
+	if ((unsigned char)(uc_ms_tick - uc_skps_request_time) >= SKPS_BURST_TIMEOUT_MS) {
+		b_skps_timeout = 1;
+		uc_skps_received = SKPS_RESYNC;
+		uc_skps_request_time = uc_ms_tick;
+	}
+	return 0;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_skps_get
+*
+* PARAMETERS:
+* ~ uc_field	- p_cross, p_joy_lx... one of the fields in skps_field[].
+*
+* RETURN:
+* ~ The value of the field in the last snapshot.
+*
+* DESCRIPTIONS:
+* Read one field of the snapshot collected by uc_skps_update().
+*
+*******************************************************************************/
+unsigned char uc_skps_get(unsigned char uc_field)
+{
+	return skps_snapshot[uc_field];
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: skps_show_rate
+*
+* PARAMETERS:
+* ~ uc_rate	- Number of snapshots in the last second.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Display the loop rate on the 2nd line of the LCD, eg. " 85Hz".
+*
+*******************************************************************************/
+void skps_show_rate(unsigned char uc_rate)
+{
+	lcd_goto(0x40);
+	lcd_putchar((uc_rate >= 100) ? (uc_rate / 100 + '0') : ' ');
+	lcd_putchar((uc_rate >= 10) ? (uc_rate / 10 % 10 + '0') : ' ');
+	lcd_putchar(uc_rate % 10 + '0');
+	lcd_putstr("Hz   ");
+}
+
 /*******************************************************************************
 * PRIVATE FUNCTION: motor
 *
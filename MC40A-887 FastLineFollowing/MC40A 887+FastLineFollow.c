@@ -28,17 +28,62 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 // Oscillator Frequency.
 #define	_XTAL_FREQ		8000000		//using internal osc
 
+// HD44780 execution time in us, 37us and 1.52ms at 270kHz plus margin
+#define LCD_T_EXEC_US	40
+#define LCD_T_HOME_US	1640
+// E pulse must stay high at least 230ns, one instruction cycle at 8MHz
+#if _XTAL_FREQ > 8000000
+#define LCD_E_DELAY()	NOP()
+#else
+#define LCD_E_DELAY()
+#endif
+
+// Timer 0 interrupt every 1ms, prescaler 1:8
+#define TMR0_PS			0b010
+#define TMR0_RELOAD		(256 - _XTAL_FREQ / 4 / 8 / 1000)
+
+// Buzzer patterns, played by the Timer 0 interrupt
+#define BEEP_MS			50			// on and off time of beep()
+#define BEEP_QUEUE		4			// patterns waiting, must be a power of 2
+
+// PWM period, 10 bit duty cycle of PWM_DUTY_MAX is 100%
+#define PWM_PR2			0x65
+#define PWM_DUTY_MAX	((PWM_PR2 + 1) * 4)
+
+// Control loop heartbeat, Timer 2 postscaler interrupt every CONTROL_POSTSCALE
+// PWM periods. Timer 1 counts Fosc/4 from each heartbeat for the loop time.
+#define CONTROL_POSTSCALE	10			// 1 to 16, 10 x 204us = 2.04ms at 8MHz
+#define CONTROL_PERIOD_T1	((PWM_PR2 + 1) * 4 * CONTROL_POSTSCALE)	// Timer 1 counts, Timer 2 prescale is 4
+#define CONTROL_PER_SECOND	(_XTAL_FREQ / 4 / CONTROL_PERIOD_T1)
+
 // UART baud rate
 #define UART_BAUD		9600
 
+// PID line following, comment out to use the line_follow_speed[] ladder.
+// Gains are fixed point, 256 = 1.0, position is -32 (LEFT) to 32 (RIGHT).
+#define PID_LINE_FOLLOW
+#define PID_KP			1280		// 5.0 duty per position step
+#define PID_KI			4			// 0.016
+#define PID_KD			1536		// 6.0, per heartbeat
+#define PID_BASE		340			// 10 bit duty on a straight line
+#define PID_OUT_MAX		340			// output clamp, one wheel stops at most
+#define PID_I_MAX		((long)PID_OUT_MAX * 256 / PID_KI)	// integrator clamp
+#define PID_POS_LOST	40			// position when the line is lost, past the last sensor
+
 // I/O Connections.
 // Parallel 2x16 Character LCD
 #define LCD_E			RE2		// E clock pin is connected to RB5	
-#define LCD_RS			RB6		// RS pin is used for LCD to differentiate data is command or character
+#define PORTB_LCD_RS	0b01000000	// RB6, RS pin is used for LCD to differentiate data is command or character
 #define	LCD_DATA		PORTD	// Data port of LCD is connected to PORTD, 4 bit mode								
+//#define LCD_RW		RC3		// LCD R/W pin, set as output, if connected: poll the busy flag
+#define LCD_DATA_TRIS	TRISD
+#define LCD_BUSY		RD7		// busy flag, DB7
+#define LCD_ROWS		2		// 2x8 LCD, frame buffer size
+#define LCD_COLS		8
+#define LCD_SIZE		(LCD_ROWS * LCD_COLS)
 
 // LED on MC40A
-#define LED1			RB7
+#define PORTB_LED1		0b10000000	// RB7
 
 // Push button on MC40A
 #define SW1				RB0		
@@ -49,17 +94,33 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 #define LIMIT2			RA2		//limit switch 2
 
 // Buzzer
-#define BUZZER			RB7
+#define PORTB_BUZZER	0b10000000	// RB7, same pin as LED1
 
 // L293B, H-Bridge IC to drive either DC brush or Stepper Motor
 #define ML_EN			RC1		// this pin is connected to Enable of L293 H-bridge driver, it is being use for speed control, for Motor left
 #define MR_EN			RC2		// this pin is connected to Enable of L293 H-bridge driver, it is being use for speed control, for Motor right
 
-// L293 pin for DC Brushed Motor
-#define MR_1			RB2		//right motor pin 1
-#define MR_2			RB3		//right motor pin 2
-#define ML_1			RB4		//left motor pin 1
-#define ML_2			RB5		//left motor pin 2
+// L293 pin for DC Brushed Motor, PORTB bits
+#define PORTB_MR_1		0b00000100	// RB2, right motor pin 1
+#define PORTB_MR_2		0b00001000	// RB3, right motor pin 2
+#define PORTB_ML_1		0b00010000	// RB4, left motor pin 1
+#define PORTB_ML_2		0b00100000	// RB5, left motor pin 2
+#define PORTB_MR		(PORTB_MR_1 | PORTB_MR_2)
+#define PORTB_ML		(PORTB_ML_1 | PORTB_ML_2)
+#define PORTB_MOTORS	(PORTB_MR | PORTB_ML)
+
+// Motor directions for portb_write(), 0 is stop
+#define MR_FORWARD		PORTB_MR_1
+#define MR_REVERSE		PORTB_MR_2
+#define MR_BRAKE		PORTB_MR
+#define ML_FORWARD		PORTB_ML_2
+#define ML_REVERSE		PORTB_ML_1
+#define ML_BRAKE		PORTB_ML
+
+// PORTB outputs are written from uc_portb_shadow, every update is a single
+// write of the whole port. portb_write() in the program, PORTB_WRITE_ISR()
+// in the interrupt, which cannot be interrupted itself.
+#define PORTB_WRITE_ISR(mask, value)	(PORTB = uc_portb_shadow = (uc_portb_shadow & ~(mask)) | ((value) & (mask)))
 
 // LSS05 sensor input assignment
 #define SEN1			RA3		
@@ -82,6 +143,9 @@ __CONFIG(INTIO &		// Internal Clock, pins as I/O.
 *******************************************************************************/
 //Line Following functions
 void fast_line_follow(void);	
+void pid_line_follow(void);
+signed char sc_line_position(unsigned char uc_sensor);
+unsigned char uc_lss05_read(void);
 void calibrate_LSS05(void);
 // ADC functions
 void adc_init(void);
@@ -90,11 +154,14 @@ unsigned int ui_adc_read(void);
 void pwm_init(void);
 void set_pwmr(unsigned char uc_duty_cycle);
 void set_pwml(unsigned char uc_duty_cycle);
+void set_pwmr_10bit(unsigned int ui_duty_cycle);
+void set_pwml_10bit(unsigned int ui_duty_cycle);
 // LCD functions
 void send_lcd_data(unsigned char b_rs, unsigned char uc_data);
 void set_lcd_e(unsigned char b_output);
 void set_lcd_rs(unsigned char b_output);
 void set_lcd_data(unsigned char uc_data);
+void lcd_wait_busy(void);
 void lcd_init(void);
 void lcd_clr(void);
 void lcd_home(void);
@@ -102,21 +169,96 @@ void lcd_2ndline(void);
 void lcd_goto(unsigned char uc_position);
 void lcd_putchar(char c_data);
 void lcd_putstr(const char* csz_string);
+void lcd_refresh(void);
+// Timer functions
+void timer0_init(void);
+void control_start(void);
+void control_wait(void);
+void control_show_slack(unsigned char uc_position);
 // SKPS functions
 unsigned char uc_skps(unsigned char uc_data);
 void skps_vibrate(unsigned char uc_motor, unsigned char uc_value);
 void skps_reset(void);
 
 void delay_ms(unsigned int ui_value);
+void portb_write(unsigned char uc_mask, unsigned char uc_value);
 void beep(unsigned char uc_count);
+unsigned char beep_pattern(unsigned char uc_count, unsigned int ui_on_ms, unsigned int ui_off_ms);
+unsigned char beep_busy(void);
+void beep_wait(void);
+void beep_isr(void);
 void SKPS_control(void);
 // functions for line following
-void motor(unsigned char uc_left_motor_speed,unsigned char uc_right_motor_speed);
+void motor(unsigned int ui_left_motor_speed, unsigned int ui_right_motor_speed);
 
 
 /*******************************************************************************
 * Global Variables                                                             *
 *******************************************************************************/
+// LCD frame buffer, lcd_buffer[] is what the program wants on the LCD and
+// lcd_shown[] is what the LCD is showing.
+const unsigned char lcd_row_address[4] = {0x00, 0x40, 0x14, 0x54};
+volatile unsigned char lcd_buffer[LCD_SIZE];
+unsigned char lcd_shown[LCD_SIZE];
+unsigned char uc_lcd_cursor, uc_lcd_row_end;	// next lcd_buffer[] character and end of its row
+unsigned char uc_lcd_scan, uc_lcd_address;		// next character to check, LCD address counter
+volatile bit b_lcd_dirty;						// lcd_buffer[] changed since last refresh pass
+
+unsigned char uc_portb_shadow;					// last value written to PORTB
+
+// Buzzer pattern queue, beep_pattern() writes uc_beep_head and the interrupt uc_beep_tail.
+unsigned char beep_count[BEEP_QUEUE];
+unsigned int beep_on_ms[BEEP_QUEUE], beep_off_ms[BEEP_QUEUE];
+volatile unsigned char uc_beep_head, uc_beep_tail;
+volatile unsigned int ui_beep_time;				// ms left of the on or off time
+unsigned char uc_beep_left;						// beeps left of the playing pattern
+unsigned int ui_beep_on, ui_beep_off;			// on and off time of the playing pattern
+bit b_beep_on;									// buzzer is on
+
+// Control loop heartbeat and the duty cycles waiting for it
+volatile unsigned char uc_control_tick;			// +1 every heartbeat in the Timer 2 interrupt
+unsigned char uc_control_last;					// uc_control_tick of the current pass
+unsigned int ui_control_worst;					// longest pass in Timer 1 counts
+unsigned int ui_control_overrun;				// passes longer than the heartbeat
+volatile unsigned char uc_ccpr1l_next, uc_ccpr2l_next;	// duty cycle for the next heartbeat
+volatile unsigned char uc_ccp1con_next, uc_ccp2con_next;	// with the 2 LSB
+volatile bit b_pwmr_next, b_pwml_next;			// new duty cycle waiting
+
+// Left and right motor 10 bit duty cycle for every LSS05 pattern returned by uc_lss05_read()
+const unsigned int line_follow_speed[32][2] = {
+	{  0,   0},	// 00000 line lost, keep last speed
+	{320,   0},	// 00001 moved to most right
+	{332, 260},	// 00010 moved to right
+	{320,  80},	// 00011 moved to right, hard
+	{340, 340},	// 00100 straight
+	{340, 340},	// 00101 straight
+	{340, 320},	// 00110 moved to right a little
+	{340, 320},	// 00111 moved to right a little
+	{260, 332},	// 01000 moved to left
+	{260, 332},	// 01001 moved to left
+	{260, 332},	// 01010 moved to left
+	{260, 332},	// 01011 moved to left
+	{320, 340},	// 01100 moved to left a little
+	{320, 340},	// 01101 moved to left a little
+	{340, 340},	// 01110 wide line, straight
+	{320,  80},	// 01111 moved to right, hard
+	{  0, 320},	// 10000 moved to most left
+	{  0, 320},	// 10001 moved to most left
+	{332, 260},	// 10010 moved to right
+	{320,  80},	// 10011 moved to right, hard
+	{340, 340},	// 10100 straight
+	{340, 340},	// 10101 straight
+	{340, 320},	// 10110 moved to right a little
+	{340, 320},	// 10111 moved to right a little
+	{ 80, 320},	// 11000 moved to left, hard
+	{ 80, 320},	// 11001 moved to left, hard
+	{332, 260},	// 11010 moved to right
+	{ 80, 320},	// 11011 moved to left, hard
+	{320, 340},	// 11100 moved to left a little
+	{320, 340},	// 11101 moved to left a little
+	{ 80, 320},	// 11110 moved to left, hard
+	{ 80, 320} 	// 11111 moved to left, hard
+};
 
 
 /*******************************************************************************
@@ -132,7 +274,8 @@ int main(void)
 	IRCF0 = 1;		// IRCF<2:0> = 101 => 2MHz, PORTA = 0;
 	
 	// clear port value
-	PORTB = 0;
+	uc_portb_shadow = 0;
+	PORTB = uc_portb_shadow;
 	PORTC = 0;
 	PORTD = 0;
 	PORTE = 0;
@@ -152,6 +295,10 @@ int main(void)
 	
 	// Initialize the LCD.
 	lcd_init();		// call this function is 2x8 LCD is connected to MC40A
+	
+	// Initialize Timer 0, the LCD is refreshed from its interrupt.
+	timer0_init();
+	GIE = 1;
 			
 	// Display the messages and beep twice.
 	lcd_clr();
@@ -166,7 +313,51 @@ int main(void)
 	lcd_clr();
 	lcd_putstr("Cal Done\nLine Fol");
 	delay_ms(1500);			//wait for 1.5 second
+#ifdef PID_LINE_FOLLOW
+	pid_line_follow();
+#else
 	fast_line_follow();		
+#endif
+}
+
+
+/*******************************************************************************
+* INTERRUPT SERVICE ROUTINE                                                    *
+*******************************************************************************/
+void interrupt isr(void)
+{
+	// Timer 2 postscaler, the control loop heartbeat.
+	if (TMR2IE == 1 && TMR2IF == 1) {
+		TMR2IF = 0;
+		TMR1L = 0;		// Timer 1 counts from the heartbeat, low byte first
+		TMR1H = 0;		// so it cannot carry into the high byte
+		uc_control_tick++;
+		
+		// Apply new duty cycles at the start of a PWM period, so both bytes
+		// are latched together and every update has the same delay.
+		if (b_pwmr_next == 1) {
+			CCP1CON = uc_ccp1con_next;
+			CCPR1L = uc_ccpr1l_next;
+			b_pwmr_next = 0;
+		}
+		if (b_pwml_next == 1) {
+			CCP2CON = uc_ccp2con_next;
+			CCPR2L = uc_ccpr2l_next;
+			b_pwml_next = 0;
+		}
+	}
+	
+	// Timer 0 overflow, every 1ms.
+	if (T0IE == 1 && T0IF == 1) {
+		T0IF = 0;
+		TMR0 += TMR0_RELOAD;
+		
+		// Next step of the buzzer pattern.
+		beep_isr();
+		
+		// Send one changed character to the LCD.
+		lcd_refresh();
+	}
 }
 
 
@@ -192,6 +383,34 @@ void delay_ms(unsigned int ui_value)
 }	
 
 
+/*******************************************************************************
+* PRIVATE FUNCTION: portb_write
+*
+* PARAMETERS:
+* ~ uc_mask		- PORTB bits to change.
+* ~ uc_value	- New value of those bits.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Update the masked bits of uc_portb_shadow and write it to PORTB at once,
+* instead of a read-modify-write of the port for every pin. The interrupt
+* writes LCD RS and the buzzer through the shadow too, so it is held off
+* while the shadow is updated.
+*
+*******************************************************************************/
+void portb_write(unsigned char uc_mask, unsigned char uc_value)
+{
+	unsigned char uc_gie = GIE;
+	
+	GIE = 0;
+	uc_portb_shadow = (uc_portb_shadow & ~uc_mask) | (uc_value & uc_mask);
+	PORTB = uc_portb_shadow;
+	GIE = uc_gie;
+}
+
+
 
 /*******************************************************************************
 * PRIVATE FUNCTION: beep
@@ -203,17 +422,142 @@ void delay_ms(unsigned int ui_value)
 * ~ void
 *
 * DESCRIPTIONS:
-* Beep for the specified number of times.
+* Beep for the specified number of times, returns without waiting for it.
 *
 *******************************************************************************/
 void beep(unsigned char uc_count)
 {
-	while (uc_count-- > 0) {
-		BUZZER = 1;
-		delay_ms(50);
-		BUZZER = 0;
-		delay_ms(50);
+	beep_pattern(uc_count, BEEP_MS, BEEP_MS);
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_pattern
+*
+* PARAMETERS:
+* ~ uc_count	- How many beeps.
+* ~ ui_on_ms	- Buzzer on time of each beep in miliseconds.
+* ~ ui_off_ms	- Buzzer off time after each beep in miliseconds.
+*
+* RETURN:
+* ~ 1 if the pattern is queued, 0 if the queue is full and it is dropped.
+*
+* DESCRIPTIONS:
+* Queue a beep pattern and return at once, the Timer 0 interrupt plays the
+* queued patterns one after the other. LED1 shares the pin, wait for
+* beep_busy() to return 0 before writing PORTB_BUZZER or PORTB_LED1.
+*
+*******************************************************************************/
+unsigned char beep_pattern(unsigned char uc_count, unsigned int ui_on_ms, unsigned int ui_off_ms)
+{
+	unsigned char uc_next = (uc_beep_head + 1) & (BEEP_QUEUE - 1);
+	
+	if (uc_next == uc_beep_tail || uc_count == 0) {
+		return 0;
+	}
+	
+	beep_count[uc_beep_head] = uc_count;
+	beep_on_ms[uc_beep_head] = ui_on_ms;
+	beep_off_ms[uc_beep_head] = ui_off_ms;
+	uc_beep_head = uc_next;		// written last, the interrupt may take it at once
+	return 1;
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_busy
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ 1 while a pattern is playing or queued, else 0.
+*
+* DESCRIPTIONS:
+* Check whether the buzzer is still in use by the queued patterns.
+* ui_beep_time is two bytes written by the Timer 0 interrupt, so it is
+* held off while they are read.
+*
+*******************************************************************************/
+unsigned char beep_busy(void)
+{
+	unsigned char uc_t0ie = T0IE;
+	unsigned char uc_busy;
+	
+	T0IE = 0;
+	uc_busy = (ui_beep_time != 0 || uc_beep_tail != uc_beep_head);
+	T0IE = uc_t0ie;
+	return uc_busy;
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_wait
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Wait until all the queued patterns are played.
+*
+*******************************************************************************/
+void beep_wait(void)
+{
+	while (beep_busy() == 1);
+}
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: beep_isr
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Called every 1ms by the Timer 0 interrupt. Counts down the on or off time
+* and switches the buzzer, then takes the next pattern from the queue.
+*
+*******************************************************************************/
+void beep_isr(void)
+{
+	if (ui_beep_time != 0 && --ui_beep_time != 0) {
+		return;
 	}
+	
+	// On time over, off for the rest of this beep.
+	if (b_beep_on == 1) {
+		PORTB_WRITE_ISR(PORTB_BUZZER, 0);
+		b_beep_on = 0;
+		ui_beep_time = ui_beep_off;
+		if (ui_beep_time != 0) {
+			return;
+		}
+	}
+	
+	// Off time over, next beep of this pattern or the next pattern.
+	if (uc_beep_left == 0) {
+		if (uc_beep_tail == uc_beep_head) {
+			return;
+		}
+		uc_beep_left = beep_count[uc_beep_tail];
+		ui_beep_on = beep_on_ms[uc_beep_tail];
+		ui_beep_off = beep_off_ms[uc_beep_tail];
+		uc_beep_tail = (uc_beep_tail + 1) & (BEEP_QUEUE - 1);
+	}
+	uc_beep_left--;
+	PORTB_WRITE_ISR(PORTB_BUZZER, PORTB_BUZZER);
+	b_beep_on = 1;
+	ui_beep_time = ui_beep_on;
 }
 // ============================ line following functions ================================
 /*******************************************************************************
@@ -227,75 +571,165 @@ void beep(unsigned char uc_count)
 *
 * DESCRIPTIONS:
 * perform line following in fast speed. This function must use SPG10-30K and 46x10mm mini wheel,
-* the position of motor to LSS05 is very important.
+* the position of motor to LSS05 is very important. One pass every control heartbeat.
 *******************************************************************************/
 void fast_line_follow(void)
 {
+	unsigned char uc_sensor;
+	unsigned int ui_beats = 0;
+	
 	lcd_clr();
 	lcd_putstr("  MC40A\nLine Fol");
-	//motor right forward	
-	MR_1 = 1;
-	MR_2 = 0;
-	//motor left forward
-	ML_1 = 0;
-	ML_2 = 1;
+	portb_write(PORTB_MOTORS, MR_FORWARD | ML_FORWARD);
+	control_start();
 	while(1)
 	{
-	if((M_LEFT == 0)&&(MIDDLE == 1)&&(M_RIGHT == 0)) //check middle, middle left and middle right sensor
-														//assuming black line, dark ON
-		{		
-			motor(85,85);	// robot move straight with both left and right motor moving at same speed
-			//motor(uc_left_motor_speed, uc_right_motor_speed)			
+		control_wait();
+		if (++ui_beats >= CONTROL_PER_SECOND) {	// loop slack once a second
+			ui_beats = 0;
+			control_show_slack(0x40);
 		}
 		
-		else if((M_LEFT == 1)&&(MIDDLE == 1)&&(M_RIGHT == 0)) // robot has move to left a little bit
-		{			
-			motor(80,85);	// robot turning to left
-			//motor(120,200);
-		}		
-		
-		else if((M_LEFT == 0)&&(MIDDLE == 1)&&(M_RIGHT == 1)) // robot has move to right a little bit
-		{			
-			motor(85,80);	// robot turning to right
-			//motor(200,120);
+		uc_sensor = uc_lss05_read();	// sample LSS05 once per pass
+		if (uc_sensor != 0)				// line lost, keep last speed
+		{
+			motor(line_follow_speed[uc_sensor][0], line_follow_speed[uc_sensor][1]);
 		}
-		
-		else if((LEFT == 0)&&(M_LEFT == 1)&&(MIDDLE == 0))	// robot has move to left
-		{			
-			motor(65,83);	// robot turning to Left, hard
-			//motor(80,180);
+	}//while(1)
+	
+}	
+/*******************************************************************************
+* PUBLIC FUNCTION: pid_line_follow
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Line following with an integer PID on the LSS05 position, run once every
+* control heartbeat so the response does not depend on how fast the loop
+* spins. The output steers around PID_BASE and is clamped to
+* +/-PID_OUT_MAX. The integrator is clamped and holds while the output is
+* saturated the same way, so it does not wind up on a long curve.
+* With these gains the P term is 160 under RIGHT and 200 with the line
+* lost. Only the D term on a fast jump, or the integrator after about
+* half a second lost, reaches the clamp.
+*******************************************************************************/
+void pid_line_follow(void)
+{
+	unsigned int ui_beats = 0;
+	signed char sc_error, sc_last_error = 0;
+	int i_integral = 0;
+	long l_output;
+	int i_left, i_right;
+	
+	lcd_clr();
+	lcd_putstr("  MC40A\nPID Fol");
+	portb_write(PORTB_MOTORS, MR_FORWARD | ML_FORWARD);
+	control_start();
+	while(1)
+	{
+		control_wait();
+		if (++ui_beats >= CONTROL_PER_SECOND) {	// loop slack once a second
+			ui_beats = 0;
+			control_show_slack(0x40);
 		}
-				
-		else if((MIDDLE == 0)&&(M_RIGHT == 1)&&(RIGHT == 0))// robot has move to right
-		{		
-			motor(83,65);	// robot turning to right, hard
-			//motor(180,80);
-		}	
-		else if((LEFT == 1)&&(M_LEFT == 1))	// robot has move to left
-		{			
-			motor(20,80);	// robot turning to Left, hard
-			//motor(55,140);
+		
+		sc_error = sc_line_position(uc_lss05_read());	// set point is 0, the middle
+		l_output = ((long)PID_KP * sc_error + (long)PID_KI * i_integral
+					+ (long)PID_KD * (sc_error - sc_last_error)) >> 8;
+		sc_last_error = sc_error;
+		
+		if (l_output > PID_OUT_MAX) {
+			l_output = PID_OUT_MAX;
+			if (sc_error < 0) i_integral += sc_error;		// only unwind while saturated
 		}
-				
-		else if((M_RIGHT == 1)&&(RIGHT == 1))// robot has move to right
-		{		
-			motor(80,20);	// robot turning to right, hard
-			//motor(140,55);
-		}	
-		else if((LEFT == 1)&&(M_LEFT == 0))	// robot has move to the most left side
-		{			
-			motor(0,80);	// robot turning to Left, hard
-			//motor(0,150);
+		else if (l_output < -PID_OUT_MAX) {
+			l_output = -PID_OUT_MAX;
+			if (sc_error > 0) i_integral += sc_error;
 		}
-				
-		else if((M_RIGHT == 0)&&(RIGHT == 1))// robot has move to the most right site
-		{		
-			motor(80,0);	// robot turning to right, hard
-			//motor(150,0);
-		}	
-	}//while(1)
+		else i_integral += sc_error;
+		if (i_integral > PID_I_MAX) i_integral = PID_I_MAX;
+		else if (i_integral < -PID_I_MAX) i_integral = -PID_I_MAX;
+		
+		// Line to the right is a positive error, speed up the left motor.
+		i_left = PID_BASE + (int)l_output;
+		i_right = PID_BASE - (int)l_output;
+		if (i_left > PWM_DUTY_MAX) i_left = PWM_DUTY_MAX;
+		else if (i_left < 0) i_left = 0;
+		if (i_right > PWM_DUTY_MAX) i_right = PWM_DUTY_MAX;
+		else if (i_right < 0) i_right = 0;
+		motor(i_left, i_right);
+	}
+}
+
+/*******************************************************************************
+* PUBLIC FUNCTION: sc_line_position
+*
+* PARAMETERS:
+* ~ uc_sensor	- LSS05 pattern from uc_lss05_read().
+*
+* RETURN:
+* ~ Line position, -32 under LEFT to 32 under RIGHT, 16 per sensor
+*
+* DESCRIPTIONS:
+* Average position of the sensors on the line, two neighbours on give the
+* half step between them. With no sensor on, the line is past the side it
+* was last seen on, +/-PID_POS_LOST.
+*
+*******************************************************************************/
+signed char sc_line_position(unsigned char uc_sensor)
+{
+	static signed char sc_last = 0;
+	signed char sc_sum = 0;
+	unsigned char uc_count = 0;
 	
-}	
+	if (uc_sensor == 0) {
+		if (sc_last < 0) return -PID_POS_LOST;
+		if (sc_last > 0) return PID_POS_LOST;
+		return 0;
+	}
+	if (uc_sensor & 0b10000) { sc_sum -= 32; uc_count++; }	// LEFT
+	if (uc_sensor & 0b01000) { sc_sum -= 16; uc_count++; }	// M_LEFT
+	if (uc_sensor & 0b00100) uc_count++;					// MIDDLE
+	if (uc_sensor & 0b00010) { sc_sum += 16; uc_count++; }	// M_RIGHT
+	if (uc_sensor & 0b00001) { sc_sum += 32; uc_count++; }	// RIGHT
+	
+	if (uc_count > 1) sc_sum /= (signed char)uc_count;
+	sc_last = sc_sum;
+	return sc_sum;
+}
+
+/*******************************************************************************
+* PUBLIC FUNCTION: uc_lss05_read
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ LSS05 pattern, bit 4 to bit 0 = LEFT, M_LEFT, MIDDLE, M_RIGHT, RIGHT
+*
+* DESCRIPTIONS:
+* Sample PORTA and PORTE once and pack the five LSS05 outputs into one index
+* for line_follow_speed[].
+*
+*******************************************************************************/
+unsigned char uc_lss05_read(void)
+{
+	unsigned char uc_porta = PORTA;		// read both ports once so all five bits
+	unsigned char uc_porte = PORTE;		// belong to the same sample
+	unsigned char uc_sensor = 0;
+	
+	if (uc_porta & 0b00001000) uc_sensor |= 0b10000;	// LEFT, RA3
+	if (uc_porta & 0b00010000) uc_sensor |= 0b01000;	// M_LEFT, RA4
+	if (uc_porta & 0b00100000) uc_sensor |= 0b00100;	// MIDDLE, RA5
+	if (uc_porte & 0b00000001) uc_sensor |= 0b00010;	// M_RIGHT, RE0
+	if (uc_porte & 0b00000010) uc_sensor |= 0b00001;	// RIGHT, RE1
+	return uc_sensor;
+}
+
 /*******************************************************************************
 * PUBLIC FUNCTION: calibrate_LSS05
 *
@@ -316,27 +750,17 @@ void calibrate_LSS05(void)
 	LSS_CAL = 0;	// release the low signal on LSS05 calibration switch
 	delay_ms(1000);	// wait for LSS05 to start calibration
 	//calibration will start, pivot right and keep round	
-	//motor right reverse	
-	MR_1 = 0;
-	MR_2 = 1;
-	//motor left forward
-	ML_1 = 0;
-	ML_2 = 1;
-	motor(75, 75);	// pivot right with low speed for LSS05 to detect line
+	portb_write(PORTB_MOTORS, MR_REVERSE | ML_FORWARD);
+	motor(300, 300);	// pivot right with low speed for LSS05 to detect line
 	delay_ms(100);
-	motor(57, 57);	// pivot right with low speed for LSS05 to detect line
+	motor(228, 228);	// pivot right with low speed for LSS05 to detect line
 	delay_ms(7000);	// wait for 6 second
 	
 	while(SEN5 == 0) continue; //wait for sensor right to detect line, when detect line is high for dark on 
-	motor(53, 53);				// change to lower speed while approaching center			
+	motor(212, 212);			// change to lower speed while approaching center			
 	while(SEN3 == 0) continue; //wait for sensor middle to detect line, when detect line is high for dark on 
 	delay_ms(10);
-	//motor right brake	
-	MR_1 = 0;
-	MR_2 = 0;
-	//motor left brake
-	ML_1 = 0;
-	ML_2 = 0;		
+	portb_write(PORTB_MOTORS, 0);	// both motors stop
 }
 
 // ================================== ADC functions ======================================
@@ -441,11 +865,12 @@ extern unsigned int ui_adc_read(void)
 void pwm_init(void)
 {
 	// Setting PWM frequency = 4.90KHz at 8MHz OSC Freq
-	PR2 = 0x65;
+	PR2 = PWM_PR2;
 	T2CKPS1 = 0;
 	T2CKPS0 = 1;	// Timer 2 prescale = 4.
 	
 	CCPR1L = 0;		// Duty cycle = 0;
+	T2CON = (T2CON & 0b00000111) | ((CONTROL_POSTSCALE - 1) << 3);	// TOUTPS<3:0>, heartbeat
 	TMR2ON = 1;		// Turn on Timer 2.	
 	
 	//configuration for CCP1CON
@@ -468,6 +893,12 @@ void pwm_init(void)
 	CCP2M2 = 1;		
 	CCP2M1 = 0;
 	CCP2M0 = 0;	
+	
+	// Heartbeat interrupt, set_pwmr() and set_pwml() need it from now on.
+	T1CON = 0b00000001;		// Timer 1 on, Fosc/4, prescale 1:1
+	TMR2IF = 0;
+	TMR2IE = 1;
+	PEIE = 1;
 }	
 
 
@@ -476,38 +907,201 @@ void pwm_init(void)
 * PUBLIC FUNCTION: set_pwm1
 *
 * PARAMETERS:
-* ~ uc_duty_cycle	- The duty cycle of the PWM1.
+* ~ uc_duty_cycle	- The duty cycle of the PWM1, 8 bit (CCPR1L).
 *
 * RETURN:
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the duty cycle of the PWM1.
+* Set the duty cycle of the PWM1, the 2 LSB are cleared.
 *
 *******************************************************************************/
 void set_pwmr(unsigned char uc_duty_cycle)
 {
-	CCPR1L = uc_duty_cycle;
+	set_pwmr_10bit((unsigned int)uc_duty_cycle << 2);
 }	
 
 /*******************************************************************************
 * PUBLIC FUNCTION: set_pwm2
 *
 * PARAMETERS:
-* ~ uc_duty_cycle	- The duty cycle of the PWM2.
+* ~ uc_duty_cycle	- The duty cycle of the PWM2, 8 bit (CCPR2L).
 *
 * RETURN:
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the duty cycle of the PWM2.
+* Set the duty cycle of the PWM2, the 2 LSB are cleared.
 *
 *******************************************************************************/
 void set_pwml(unsigned char uc_duty_cycle)
 {
-	CCPR2L = uc_duty_cycle;
+	set_pwml_10bit((unsigned int)uc_duty_cycle << 2);
+}	
+
+/*******************************************************************************
+* PUBLIC FUNCTION: set_pwmr_10bit
+*
+* PARAMETERS:
+* ~ ui_duty_cycle	- The duty cycle of the PWM1, 0 to PWM_DUTY_MAX.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Set the full 10 bit duty cycle of the PWM1. Both parts are written by the
+* Timer 2 interrupt at the next heartbeat, the start of a PWM period.
+*
+*******************************************************************************/
+void set_pwmr_10bit(unsigned int ui_duty_cycle)
+{
+	b_pwmr_next = 0;	// the interrupt must not apply half of it
+	uc_ccp1con_next = (CCP1CON & 0b11001111) | (((unsigned char)ui_duty_cycle << 4) & 0b00110000);
+	uc_ccpr1l_next = (unsigned char)(ui_duty_cycle >> 2);
+	b_pwmr_next = 1;
 }	
 
+/*******************************************************************************
+* PUBLIC FUNCTION: set_pwml_10bit
+*
+* PARAMETERS:
+* ~ ui_duty_cycle	- The duty cycle of the PWM2, 0 to PWM_DUTY_MAX.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Set the full 10 bit duty cycle of the PWM2. Both parts are written by the
+* Timer 2 interrupt at the next heartbeat, the start of a PWM period.
+*
+*******************************************************************************/
+void set_pwml_10bit(unsigned int ui_duty_cycle)
+{
+	b_pwml_next = 0;	// the interrupt must not apply half of it
+	uc_ccp2con_next = (CCP2CON & 0b11001111) | (((unsigned char)ui_duty_cycle << 4) & 0b00110000);
+	uc_ccpr2l_next = (unsigned char)(ui_duty_cycle >> 2);
+	b_pwml_next = 1;
+}	
+
+// ================================== Timer functions ====================================
+
+/*******************************************************************************
+* PUBLIC FUNCTION: timer0_init
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Initialize Timer 0 to interrupt every 1ms.
+*
+*******************************************************************************/
+void timer0_init(void)
+{
+	// Clock = Fosc/4, prescaler assigned to Timer 0.
+	OPTION_REG = (OPTION_REG & 0b11000000) | TMR0_PS;
+	
+	TMR0 = TMR0_RELOAD;
+	T0IF = 0;
+	T0IE = 1;		// Enable Timer 0 interrupt.
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_start
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Call before a control loop, clears the loop time figures.
+*
+*******************************************************************************/
+void control_start(void)
+{
+	uc_control_last = uc_control_tick;
+	ui_control_worst = 0;
+	ui_control_overrun = 0;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_wait
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Call at the top of a control loop, it returns right after the next heartbeat
+* so every pass starts at the same point of the PWM period. The time of the
+* last pass is read from Timer 1 first and the longest is kept. A pass that
+* missed the heartbeat is counted as an overrun and does not wait.
+*
+*******************************************************************************/
+void control_wait(void)
+{
+	unsigned char uc_high;
+	unsigned int ui_time;
+	
+	do {		// read the high byte again if the low byte carried into it
+		uc_high = TMR1H;
+		ui_time = ((unsigned int)uc_high << 8) | TMR1L;
+	} while (uc_high != TMR1H);
+	
+	if (uc_control_tick != uc_control_last) {
+		ui_control_overrun++;
+	}
+	else {
+		if (ui_time > ui_control_worst) ui_control_worst = ui_time;
+		while (uc_control_tick == uc_control_last) continue;
+	}
+	uc_control_last = uc_control_tick;
+}
+
+
+
+/*******************************************************************************
+* PUBLIC FUNCTION: control_show_slack
+*
+* PARAMETERS:
+* ~ uc_position	- LCD address, 0x00 for the 1st line, 0x40 for the 2nd line.
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Display the worst case slack of the control loop, the heartbeat period less
+* the longest pass, eg. "S1480us ". "Overrun " once a pass was too long.
+*
+*******************************************************************************/
+void control_show_slack(unsigned char uc_position)
+{
+	unsigned int ui_slack_us;
+	
+	lcd_goto(uc_position);
+	if (ui_control_overrun != 0) {
+		lcd_putstr("Overrun ");
+		return;
+	}
+	ui_slack_us = (unsigned int)((unsigned long)(CONTROL_PERIOD_T1 - ui_control_worst) * 4000 / (_XTAL_FREQ / 1000));
+	lcd_putchar('S');
+	lcd_putchar(ui_slack_us / 1000 % 10 + '0');
+	lcd_putchar(ui_slack_us / 100 % 10 + '0');
+	lcd_putchar(ui_slack_us / 10 % 10 + '0');
+	lcd_putchar(ui_slack_us % 10 + '0');
+	lcd_putstr("us ");
+}
+
 // ================================== LCD functions ======================================
 
 /*******************************************************************************
@@ -520,14 +1114,19 @@ void set_pwml(unsigned char uc_duty_cycle)
 * ~ void
 *
 * DESCRIPTIONS:
-* Initialize and clear the LCD display.
+* Initialize and clear the LCD display and the LCD frame buffer.
 *
 *******************************************************************************/
 void lcd_init(void)
 {
-	// Set the LCD E pin and wait for the LCD to be ready before we
+	unsigned char i;
+	
+	// Clear the LCD E pin and wait for the LCD to be ready before we
 	// start sending data to it.
-	set_lcd_e(1);
+	set_lcd_e(0);
+#ifdef LCD_RW
+	LCD_RW = 0;
+#endif
 	__delay_ms(15);
 	
 	// Configure the Function Set of the LCD.	
@@ -541,8 +1140,18 @@ void lcd_init(void)
 	// Configure the display on/off control of the LCD.
 	send_lcd_data(0, 0b00001100);
 	
-	// Clear the LCD display.
-	lcd_clr();
+	// Clear the LCD display, the address counter is back to 0.
+	send_lcd_data(0, 0b00000001);
+	
+	// The LCD and the frame buffer are both blank now.
+	for (i = 0; i < LCD_SIZE; i++) {
+		lcd_buffer[i] = ' ';
+		lcd_shown[i] = ' ';
+	}
+	uc_lcd_scan = 0;
+	uc_lcd_address = 0;
+	b_lcd_dirty = 0;
+	lcd_home();
 }
 
 
@@ -557,13 +1166,19 @@ void lcd_init(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* Clear the LCD display and return the cursor to the home position.
+* Clear the LCD frame buffer and return the cursor to the home position.
 *
 *******************************************************************************/
 void lcd_clr(void)
 {
-	// Send the command to clear the LCD display.
-	send_lcd_data(0, 0b00000001);
+	unsigned char i;
+	
+	// Fill the frame buffer with space, lcd_refresh() will update the LCD.
+	for (i = 0; i < LCD_SIZE; i++) {
+		lcd_buffer[i] = ' ';
+	}
+	b_lcd_dirty = 1;
+	lcd_home();
 }
 
 
@@ -583,8 +1198,8 @@ void lcd_clr(void)
 *******************************************************************************/
 void lcd_home(void)
 {
-	// Send the command to return the cursor to the home position.
-	send_lcd_data(0, 0b00000010);
+	uc_lcd_cursor = 0;
+	uc_lcd_row_end = LCD_COLS;
 }
 
 
@@ -604,8 +1219,8 @@ void lcd_home(void)
 *******************************************************************************/
 void lcd_2ndline(void)
 {
-	// Send the command to jump to the second row.
-	send_lcd_data(0, 0b11000000);
+	uc_lcd_cursor = LCD_COLS;
+	uc_lcd_row_end = LCD_COLS * 2;
 }
 
 
@@ -620,13 +1235,34 @@ void lcd_2ndline(void)
 * ~ void
 *
 * DESCRIPTIONS:
-* Jump to the defined position of the LCD display.
+* Jump to the defined position of the LCD display, 0x00 is the 1st character
+* of the 1st row and 0x40 is the 1st character of the 2nd row.
 *
 *******************************************************************************/
 void lcd_goto(unsigned char uc_position)
 {
-	// Send the command to jump to the defined position.
-	send_lcd_data(0, 0b10000000 | uc_position);
+	unsigned char uc_row = 0;
+	unsigned char uc_col = uc_position & 0b00111111;
+	
+	if (uc_position & 0b01000000) {
+		uc_row = 1;
+	}
+	
+	// 3rd and 4th row of a 4 line LCD follow the 1st and 2nd row.
+	if (uc_col >= LCD_COLS) {
+		uc_row += 2;
+		uc_col -= LCD_COLS;
+	}
+	
+	// Position outside the display, drop the characters like the LCD does.
+	if (uc_row >= LCD_ROWS || uc_col >= LCD_COLS) {
+		uc_lcd_cursor = 0;
+		uc_lcd_row_end = 0;
+		return;
+	}
+	
+	uc_lcd_row_end = (uc_row + 1) * LCD_COLS;
+	uc_lcd_cursor = uc_lcd_row_end - LCD_COLS + uc_col;
 }
 
 
@@ -641,13 +1277,16 @@ void lcd_goto(unsigned char uc_position)
 * ~ void
 *
 * DESCRIPTIONS:
-* Display a character on the LCD.
+* Write a character to the LCD frame buffer.
 *
 *******************************************************************************/
 void lcd_putchar(char c_data)
 {
-	// Send the data to display.
-	send_lcd_data(1, (unsigned char)c_data);
+	// Characters past the end of the row are not visible.
+	if (uc_lcd_cursor < uc_lcd_row_end) {
+		lcd_buffer[uc_lcd_cursor++] = (unsigned char)c_data;
+		b_lcd_dirty = 1;
+	}
 }
 
 
@@ -698,7 +1337,10 @@ void lcd_putstr(const char* csz_string)
 * ~ void
 *
 * DESCRIPTIONS:
-* Set the output of the LCD RS pin and data bus.
+* Set the output of the LCD RS pin and data bus, latch it into the LCD and
+* wait for the LCD to execute it. Clear display and return home take
+* LCD_T_HOME_US, everything else LCD_T_EXEC_US. If LCD_RW is defined the
+* busy flag is polled instead.
 *
 *******************************************************************************/
 void send_lcd_data(unsigned char b_rs, unsigned char uc_data)
@@ -708,11 +1350,133 @@ void send_lcd_data(unsigned char b_rs, unsigned char uc_data)
 		set_lcd_rs(b_rs);
 		set_lcd_data(uc_data);
 		
-		// Send a negative e pulse.
+		// Send a positive e pulse, the LCD latches the data on the falling edge.
+		set_lcd_e(1);
+		LCD_E_DELAY();
 		set_lcd_e(0);
-		__delay_ms(2);
+		
+#ifdef LCD_RW
+		lcd_wait_busy();
+#else
+		if (b_rs == 0 && uc_data < 0b00000100) {
+			__delay_us(LCD_T_HOME_US);		// clear display, return home
+		}
+		else {
+			__delay_us(LCD_T_EXEC_US);
+		}
+#endif
+}
+
+
+
+#ifdef LCD_RW
+/*******************************************************************************
+* PRIVATE FUNCTION: lcd_wait_busy
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Poll the LCD busy flag (DB7) until the last instruction is done, give up
+* after about LCD_T_HOME_US in case no LCD is connected.
+*
+*******************************************************************************/
+void lcd_wait_busy(void)
+{
+	unsigned char uc_busy;
+	unsigned char uc_timeout = LCD_T_HOME_US / 10;
+	
+	LCD_DATA_TRIS = 0xFF;		// data bus as input
+	set_lcd_rs(0);
+	LCD_RW = 1;					// read busy flag and address
+	do {
 		set_lcd_e(1);
-		__delay_ms(1);		
+		LCD_E_DELAY();			// data output delay
+		uc_busy = LCD_BUSY;
+		set_lcd_e(0);
+		__delay_us(10);
+	} while (uc_busy == 1 && --uc_timeout > 0);
+	LCD_RW = 0;
+	LCD_DATA_TRIS = 0;			// data bus as output
+}
+#endif
+
+
+
+/*******************************************************************************
+* PRIVATE FUNCTION: lcd_refresh
+*
+* PARAMETERS:
+* ~ void
+*
+* RETURN:
+* ~ void
+*
+* DESCRIPTIONS:
+* Called from the Timer 0 interrupt. Send one byte to the LCD for the next
+* character that differs from the frame buffer: the cursor address first if
+* needed, then the character. The 1ms tick covers the LCD execution time, so
+* there is no delay here. The LCD pins are written directly because
+* send_lcd_data() is also called from the main program.
+*
+*******************************************************************************/
+void lcd_refresh(void)
+{
+	unsigned char i;
+	unsigned char uc_row = 0;
+	unsigned char uc_address;
+	unsigned char uc_data;
+	
+	// Only start a new pass if the frame buffer has been changed.
+	if (uc_lcd_scan == 0) {
+		if (b_lcd_dirty == 0) {
+			return;
+		}
+		b_lcd_dirty = 0;
+	}
+	
+	// Look for the next character that is not shown yet.
+	for (i = uc_lcd_scan; i < LCD_SIZE; i++) {
+		if (lcd_buffer[i] != lcd_shown[i]) {
+			break;
+		}
+	}
+	if (i == LCD_SIZE) {
+		uc_lcd_scan = 0;
+		return;
+	}
+	uc_lcd_scan = i;
+	
+	// DDRAM address of the character.
+	uc_address = i;
+	while (uc_address >= LCD_COLS) {
+		uc_address -= LCD_COLS;
+		uc_row++;
+	}
+	uc_address += lcd_row_address[uc_row];
+	
+	if (uc_address != uc_lcd_address) {
+		// Move the LCD cursor, the character is sent on the next tick.
+		PORTB_WRITE_ISR(PORTB_LCD_RS, 0);
+		LCD_DATA = 0b10000000 | uc_address;
+		uc_lcd_address = uc_address;
+	}
+	else {
+		uc_data = lcd_buffer[i];
+		PORTB_WRITE_ISR(PORTB_LCD_RS, PORTB_LCD_RS);
+		LCD_DATA = uc_data;
+		lcd_shown[i] = uc_data;
+		uc_lcd_address++;
+		uc_lcd_scan++;
+	}
+	
+	// Send a positive e pulse.
+	LCD_E = 1;
+	LCD_E_DELAY();
+	LCD_E = 0;
 }
 
 
@@ -752,7 +1516,7 @@ void set_lcd_e(unsigned char b_output)
 *******************************************************************************/
 void set_lcd_rs(unsigned char b_output)
 {
-	LCD_RS = b_output;
+	portb_write(PORTB_LCD_RS, (b_output == 1) ? PORTB_LCD_RS : 0);
 }
 
 
@@ -781,8 +1545,8 @@ void set_lcd_data(unsigned char uc_data)
 * PRIVATE FUNCTION: motor
 *
 * PARAMETERS:
-* ~ uc_left_motor_speed
-* ~ uc_right_motor_speed
+* ~ ui_left_motor_speed	- 10 bit duty cycle, 0 to PWM_DUTY_MAX
+* ~ ui_right_motor_speed	- 10 bit duty cycle, 0 to PWM_DUTY_MAX
 *
 * RETURN:
 * ~ void
@@ -791,11 +1555,11 @@ void set_lcd_data(unsigned char uc_data)
 * move motor forward and change speed.
 *
 *******************************************************************************/
-void motor(unsigned char uc_left_motor_speed,unsigned char uc_right_motor_speed)
+void motor(unsigned int ui_left_motor_speed, unsigned int ui_right_motor_speed)
 {	
 	//set the speed for left and right motor
-	set_pwmr(uc_right_motor_speed);
-	set_pwml(uc_left_motor_speed);	
+	set_pwmr_10bit(ui_right_motor_speed);
+	set_pwml_10bit(ui_left_motor_speed);	
 }
 
 
@@ -0,0 +1,99 @@
+#ifndef BUZZER_H
+#define	BUZZER_H
+
+/***********************************
+ * buzzerPlay(3, 300, 300);    // Queue 3 beeps, returns at once
+ * buzzerIsr();                // Every 1ms from the interrupt
+ * buzzerBusy();               // 1 while a pattern plays or waits
+ * buzzerWait();               // Wait until all are played
+ *
+ * Patterns are played one after the
+ * other from a BUZZER_QUEUE ring,
+ * buzzerPlay() drops the pattern and
+ * returns 0 when it is full. LED1 is
+ * the same pin, write PORTB_BUZZER
+ * only while buzzerBusy() is 0.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+#include "portb.h"
+
+/***** Define *****/
+#define BUZZER_QUEUE 4 // Patterns waiting, power of 2
+#define BUZZER_RAM (5 * BUZZER_QUEUE + 10) // Bytes of globals below
+
+#if BUZZER_QUEUE & (BUZZER_QUEUE - 1)
+#error "BUZZER_QUEUE must be a power of 2"
+#endif
+
+/***** Buzzer function prototype *****/
+uChar buzzerPlay(uChar count, uInt onMs, uInt offMs);
+void buzzerIsr(void);
+uChar buzzerBusy(void);
+void buzzerWait(void);
+
+/***** Global variable *****/
+uChar buzzerCount[BUZZER_QUEUE]; // Queued patterns
+uInt buzzerOn[BUZZER_QUEUE], buzzerOff[BUZZER_QUEUE];
+volatile uChar buzzerHead, buzzerTail; // buzzerPlay() writes head, buzzerIsr() tail
+volatile uInt buzzerTime; // ms left of the on or off time
+uChar buzzerLeft; // Beeps left of the playing pattern
+uInt buzzerOnMs, buzzerOffMs; // Times of the playing pattern
+uChar buzzerSounding; // Buzzer is on
+
+/***** Buzzer sub function *****/
+uChar buzzerPlay(uChar count, uInt onMs, uInt offMs)
+{
+  uChar next = (buzzerHead + 1) & (BUZZER_QUEUE - 1);
+
+  if(next == buzzerTail || !count) return 0;
+  buzzerCount[buzzerHead] = count;
+  buzzerOn[buzzerHead] = onMs;
+  buzzerOff[buzzerHead] = offMs;
+  buzzerHead = next; // Last, the interrupt may start it at once
+  return 1;
+}
+
+void buzzerIsr(void)
+{
+  if(buzzerTime && --buzzerTime) return;
+
+  if(buzzerSounding) // On time over
+  {
+    PORTB_WRITE_ISR(PORTB_BUZZER, 0);
+    buzzerSounding = 0;
+    buzzerTime = buzzerOffMs;
+    if(buzzerTime) return;
+  }
+
+  if(!buzzerLeft) // Pattern over, take the next one
+  {
+    if(buzzerTail == buzzerHead) return;
+    buzzerLeft = buzzerCount[buzzerTail];
+    buzzerOnMs = buzzerOn[buzzerTail];
+    buzzerOffMs = buzzerOff[buzzerTail];
+    buzzerTail = (buzzerTail + 1) & (BUZZER_QUEUE - 1);
+  }
+  buzzerLeft--;
+  PORTB_WRITE_ISR(PORTB_BUZZER, PORTB_BUZZER);
+  buzzerSounding = 1;
+  buzzerTime = buzzerOnMs;
+}
+
+uChar buzzerBusy(void)
+{
+  uChar busy;
+
+  T0IE = 0; // buzzerTime is two bytes, no change between reading them
+  busy = buzzerTime || buzzerTail != buzzerHead;
+  T0IE = 1;
+  return busy;
+}
+
+void buzzerWait(void)
+{
+  while(buzzerBusy());
+}
+
+#endif
@@ -0,0 +1,398 @@
+#ifndef GRAPH_H
+#define	GRAPH_H
+
+/***********************************
+ * graphInit();                // Start node, heading north
+ * graphJunction(exits, 1500); // Turn to take at this junction
+ * graphFinish(800);           // Finish found, turn to take from it
+ * graphRoute();               // Shortest route to the path
+ *
+ * For looped mazes, #define MAZE_LOOPED
+ * in system.h. Junctions are placed by
+ * dead reckoning: heading (0 north,
+ * clockwise) and segment time. A known
+ * node on the line ahead, at about the
+ * segment time, is the same junction and
+ * closes the loop. The error allowed
+ * grows with the steps driven between
+ * the two placings, junctions closer
+ * than that can be mixed up.
+ * A segment already explored leads to its
+ * known node, no position guess.
+ * Unexplored exits are taken first, left
+ * hand order. Once the finish is found,
+ * only exits that could still give a
+ * shorter route are explored: known
+ * distance to the node, plus the
+ * straight distance from one step out of
+ * the exit to the finish, is less than
+ * the best route. When none is left,
+ * both return GRAPH_DONE and
+ * graphRoute() writes the shortest route
+ * to the maze.h path for replay.
+ *
+ * RAM: GRAPH_RAM, 12 bytes per node + 6,
+ * 174 bytes for 14 nodes. main.c checks
+ * the whole image against the PIC.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+#include "maze.h"
+
+/***** Define *****/
+#ifndef GRAPH_NODES
+#define GRAPH_NODES 14 // At most 15, node numbers are packed in nibbles
+#endif
+#define GRAPH_UNIT  128 // ms per coordinate step
+#define GRAPH_NEAR  2 // Position error allowed, plus 1 / GRAPH_DRIFT of the
+#define GRAPH_DRIFT 48 // steps driven between the two positions
+#define GRAPH_NONE  0xFF
+#define GRAPH_DONE  4 // graphJunction(), graphFinish(): exploration is over
+
+#define GRAPH_RAM   (12 * GRAPH_NODES + 6) // Bytes of globals below
+
+#if GRAPH_NODES > 15
+#error "GRAPH_NODES must be 15 or less"
+#elif GRAPH_NODES - 2 > PATH_MAX
+#error "PATH_MAX is too small for the longest graph.h route"
+#endif
+
+/***** Graph function prototype *****/
+void graphInit(void);
+uChar graphNode(uInt ms, uChar exits);
+uInt graphApart(uChar a, uChar b);
+uChar graphJunction(uChar exits, uInt ms);
+uChar graphFinish(uInt ms);
+uChar graphPlan(uChar n);
+uChar graphOpen(void);
+void graphRoute(void);
+void graphSearch(uChar from);
+uChar graphHeading(uChar from, uChar to);
+uChar graphLink(uChar n, uChar h);
+void graphLinkSet(uChar n, uChar h, uChar to);
+uChar graphCost(uChar from, uChar to);
+
+/***** Global variable *****/
+const sChar graphDx[4] = {0, 1, 0, -1}; // North, east, south, west
+const sChar graphDy[4] = {1, 0, -1, 0};
+const uChar graphOrder[3] = {TURN_L, TURN_S, TURN_R}; // Unexplored exit order
+
+sChar nodeX[GRAPH_NODES], nodeY[GRAPH_NODES]; // Position, GRAPH_UNIT steps
+uChar nodeFrom[GRAPH_NODES]; // Node it was placed from
+uInt nodeTravel[GRAPH_NODES]; // Steps from the start through nodeFrom[]
+uChar nodeExits[GRAPH_NODES]; // Bit 0-3: exit by heading, bit 4-7: explored
+uChar nodeLink[GRAPH_NODES * 2]; // Node through each heading, a nibble each, see graphLink()
+uInt nodeDist[GRAPH_NODES]; // graphSearch() result
+uChar nodePrev[GRAPH_NODES];
+uChar nodeOpen[GRAPH_NODES]; // graphOpen() result, exits by heading worth exploring
+
+uChar graphNodes, graphAt, graphDir; // Node count, last node, heading
+uChar graphEnd; // Finish node, GRAPH_NONE until it is found
+sChar graphX, graphY; // Dead reckoning position
+
+/***** Graph sub function *****/
+void graphInit(void)
+{
+  uChar i;
+
+  for(i = 0; i < GRAPH_NODES * 2; i++) nodeLink[i] = GRAPH_NONE;
+  nodeX[0] = 0; // Start, a dead end facing north
+  nodeY[0] = 0;
+  nodeFrom[0] = GRAPH_NONE;
+  nodeTravel[0] = 0;
+  nodeExits[0] = 0x11;
+  graphNodes = 1;
+  graphAt = 0;
+  graphDir = 0;
+  graphEnd = GRAPH_NONE;
+  graphX = 0;
+  graphY = 0;
+}
+
+uChar graphNode(uInt ms, uChar exits)
+{
+  uChar i, n = GRAPH_NONE, back, steps = 100;
+  sInt ahead, side, error, best = 0, drift;
+
+  back = (graphDir + 2) & 3;
+  if(ms < 100 * GRAPH_UNIT) steps = (ms + GRAPH_UNIT / 2) / GRAPH_UNIT;
+  if(graphAt != GRAPH_NONE) n = graphLink(graphAt, graphDir); // Explored segment
+
+  /* Junctions cannot be passed without being seen, so the node is the
+   * known one on the line ahead nearest to the segment time. Its exit
+   * this way must not lead to another node yet. */
+  if(n == GRAPH_NONE && graphAt != GRAPH_NONE)
+  {
+    for(i = 0; i < graphNodes; i++)
+    {
+      if((nodeExits[i] & 0x0F) != exits || graphLink(i, back) != GRAPH_NONE) continue;
+      ahead = (nodeX[i] - graphX) * graphDx[graphDir] + (nodeY[i] - graphY) * graphDy[graphDir];
+      side = (nodeX[i] - graphX) * graphDy[graphDir] - (nodeY[i] - graphY) * graphDx[graphDir];
+      if(side < 0) side = -side;
+      error = ahead - steps;
+      if(error < 0) error = -error;
+      drift = GRAPH_NEAR + (graphApart(graphAt, i) + steps) / GRAPH_DRIFT;
+      if(ahead <= 0 || side > drift || error > drift) continue;
+      if(n == GRAPH_NONE || error < best)
+      {
+        best = error;
+        n = i;
+      }
+    }
+  }
+
+  if(n != GRAPH_NONE) // Been here before, a loop
+  {
+    graphX = nodeX[n]; // Remove the drift
+    graphY = nodeY[n];
+  }
+  else if(graphNodes < GRAPH_NODES && graphAt != GRAPH_NONE)
+  {
+    n = graphNodes++;
+    graphX += graphDx[graphDir] * steps;
+    graphY += graphDy[graphDir] * steps;
+    nodeX[n] = graphX;
+    nodeY[n] = graphY;
+    nodeFrom[n] = graphAt;
+    nodeTravel[n] = nodeTravel[graphAt] + steps;
+    nodeExits[n] = exits;
+  }
+  else
+  {
+    graphAt = GRAPH_NONE; // Full, no more nodes
+    return GRAPH_NONE;
+  }
+
+  graphLinkSet(graphAt, graphDir, n);
+  graphLinkSet(n, back, graphAt);
+  nodeExits[n] |= 0x10 << back; // Came in from there
+  graphAt = n;
+  return n;
+}
+
+/* Steps driven between the placing of node a and node b, through the
+ * node both were placed from. Their position error grows with it. */
+uInt graphApart(uChar a, uChar b)
+{
+  uChar m;
+  uInt from = 0;
+
+  for(m = a; m != GRAPH_NONE; m = nodeFrom[m]) from |= 1U << m;
+  for(m = b; !(from & (1U << m)); m = nodeFrom[m]);
+  return nodeTravel[a] + nodeTravel[b] - 2 * nodeTravel[m];
+}
+
+uChar graphJunction(uChar exits, uInt ms)
+{
+  uChar i, n, turn = TURN_B, found = 1 << ((graphDir + 2) & 3);
+
+  for(i = 0; i < 3; i++) // Exits by heading, with the way back
+  {
+    if(exits & (1 << graphOrder[i])) found |= 1 << ((graphDir + graphOrder[i]) & 3);
+  }
+
+  n = graphNode(ms, found);
+  if(n == GRAPH_NONE) // Graph full, left hand rule
+  {
+    for(i = 0; i < 3; i++)
+    {
+      if(exits & (1 << graphOrder[i])) break;
+    }
+    if(i < 3) turn = graphOrder[i];
+    graphDir = (graphDir + turn) & 3;
+    return turn;
+  }
+  return graphPlan(n);
+}
+
+/* The finish is a dead end, a new node with the way back as its only
+ * exit. Returns the turn to take from it, GRAPH_DONE if no exit left
+ * can give a shorter route. */
+uChar graphFinish(uInt ms)
+{
+  uChar n, back = (graphDir + 2) & 3;
+
+  n = graphNode(ms, 0); // Exits unknown, always a new node
+  if(n == GRAPH_NONE) return GRAPH_DONE; // Graph full, no route
+  nodeExits[n] |= 0x01 << back;
+  graphEnd = n;
+  return graphPlan(n);
+}
+
+/* Turn to take at node n, an exit from graphOpen() here, else the first
+ * step to the nearest node with one. GRAPH_DONE when there is none. */
+uChar graphPlan(uChar n)
+{
+  uChar i, turn = TURN_B, to, from;
+
+  if(!graphOpen()) return GRAPH_DONE;
+
+  for(i = 0; i < 3; i++) // Exit worth exploring here
+  {
+    to = (graphDir + graphOrder[i]) & 3;
+    if(nodeOpen[n] & (1 << to)) break;
+  }
+  if(i < 3) turn = graphOrder[i];
+  else // Go to the nearest node with one
+  {
+    graphSearch(n);
+    to = GRAPH_NONE;
+    for(i = 0; i < graphNodes; i++)
+    {
+      if(nodeDist[i] == 0xFFFF || i == n || !nodeOpen[i]) continue;
+      if(to == GRAPH_NONE || nodeDist[i] < nodeDist[to]) to = i;
+    }
+    if(to == GRAPH_NONE) return GRAPH_DONE; // Not reachable through known nodes
+    while((from = nodePrev[to]) != n) to = from; // First step from n
+    turn = (graphHeading(n, to) - graphDir) & 3;
+  }
+
+  graphDir = (graphDir + turn) & 3;
+  nodeExits[n] |= 0x10 << graphDir;
+  return turn;
+}
+
+/* Unexplored exits of every node in nodeOpen[], once the finish is
+ * known only those whose lower bound is shorter than the best route.
+ * Returns 0 if there are none. */
+uChar graphOpen(void)
+{
+  uChar i, h, open, any = 0;
+  sInt dx, dy;
+  uInt best = 0xFFFF;
+
+  graphSearch(0);
+  if(graphEnd != GRAPH_NONE) best = nodeDist[graphEnd];
+
+  for(i = 0; i < graphNodes; i++)
+  {
+    open = (nodeExits[i] & ~(nodeExits[i] >> 4)) & 0x0F;
+    if(best != 0xFFFF) // Keep the exits that could beat the best route
+    {
+      for(h = 0; h < 4; h++)
+      {
+        if(!(open & (1 << h))) continue;
+        dx = nodeX[i] + graphDx[h] - nodeX[graphEnd];
+        dy = nodeY[i] + graphDy[h] - nodeY[graphEnd];
+        if(dx < 0) dx = -dx;
+        if(dy < 0) dy = -dy;
+        if(nodeDist[i] == 0xFFFF || nodeDist[i] + 1 + dx + dy >= best) open &= ~(1 << h);
+      }
+    }
+    nodeOpen[i] = open;
+    any |= open;
+  }
+  return any;
+}
+
+/* Shortest route from the start to the finish through the explored
+ * nodes, written to the maze.h path. Empty if there is none. */
+void graphRoute(void)
+{
+  uChar n = graphEnd, m, next, count = 0;
+
+  pathClear();
+  if(n == GRAPH_NONE || n == 0) return;
+  graphSearch(0);
+  if(nodeDist[n] == 0xFFFF) return;
+
+  for(m = nodePrev[n]; m != 0; m = nodePrev[m]) count++; // Turns on the route
+  if(count > PATH_MAX) return;
+  pathLength = count;
+  pathEnd((uInt) graphCost(nodePrev[n], n) * GRAPH_UNIT);
+
+  next = n;
+  for(m = nodePrev[n]; m != 0; m = nodePrev[m]) // Back from the finish
+  {
+    count--;
+    pathPut(count, (graphHeading(m, next) - graphHeading(nodePrev[m], m)) & 3);
+    pathPutTime(count, (uInt) graphCost(nodePrev[m], m) * GRAPH_UNIT);
+    next = m;
+  }
+}
+
+/* Shortest distance from node "from" to every node, nodeDist[] and
+ * nodePrev[], 0xFFFF if not reachable. Dijkstra, O(GRAPH_NODES^2). */
+void graphSearch(uChar from)
+{
+  uChar i, h, n, to;
+  uInt done = 0, dist;
+
+  for(i = 0; i < GRAPH_NODES; i++)
+  {
+    nodeDist[i] = 0xFFFF;
+    nodePrev[i] = GRAPH_NONE;
+  }
+  nodeDist[from] = 0;
+
+  while(1)
+  {
+    n = GRAPH_NONE;
+    for(i = 0; i < graphNodes; i++) // Nearest node not done
+    {
+      if(done & (1U << i) || nodeDist[i] == 0xFFFF) continue;
+      if(n == GRAPH_NONE || nodeDist[i] < nodeDist[n]) n = i;
+    }
+    if(n == GRAPH_NONE) break;
+    done |= 1U << n;
+
+    for(h = 0; h < 4; h++)
+    {
+      to = graphLink(n, h);
+      if(to == GRAPH_NONE) continue;
+      dist = nodeDist[n] + graphCost(n, to);
+      if(dist < nodeDist[to])
+      {
+        nodeDist[to] = dist;
+        nodePrev[to] = n;
+      }
+    }
+  }
+}
+
+/* Heading from node "from" to its neighbour "to", GRAPH_NONE if they
+ * are not linked */
+uChar graphHeading(uChar from, uChar to)
+{
+  uChar h;
+  for(h = 0; h < 4; h++)
+  {
+    if(graphLink(from, h) == to) return h;
+  }
+  return GRAPH_NONE;
+}
+
+uChar graphCost(uChar from, uChar to)
+{
+  sInt dx = nodeX[to] - nodeX[from], dy = nodeY[to] - nodeY[from];
+
+  if(dx < 0) dx = -dx;
+  if(dy < 0) dy = -dy;
+  if(dx + dy > 255) return 255;
+  if(dx + dy == 0) return 1;
+  return dx + dy; // Segments are straight, corners are junctions
+}
+
+/* Node linked to n through heading h, GRAPH_NONE if unknown. Two
+ * headings per byte, low nibble even, 0x0F unknown. */
+uChar graphLink(uChar n, uChar h)
+{
+  uChar to = nodeLink[n * 2 + (h >> 1)];
+
+  if(h & 1) to >>= 4;
+  to &= 0x0F;
+  if(to == 0x0F) return GRAPH_NONE;
+  return to;
+}
+
+void graphLinkSet(uChar n, uChar h, uChar to)
+{
+  uChar *link = &nodeLink[n * 2 + (h >> 1)];
+
+  to &= 0x0F; // GRAPH_NONE is 0x0F
+  if(h & 1) *link = (*link & 0x0F) | (to << 4);
+  else *link = (*link & 0xF0) | to;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef JUNCTION_H
+#define	JUNCTION_H
+
+/***********************************
+ * junctionReset();            // Line under senMiddle, nothing seen
+ * junctionClassify(sensor);   // Every 1ms with sensorRead()
+ *
+ * Each sensor frame is shifted into
+ * junctionHistory[], a sensor is on or
+ * off once it has read the same for
+ * JUNCTION_STABLE frames. The shape is
+ * decided JUNCTION_STABLE frames after
+ * the side sensors clear the branch.
+ * Shapes are the exits as bits TURN_L,
+ * TURN_S and TURN_R, SHAPE_T is left
+ * and right, SHAPE_CROSS all three.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+#include "maze.h"
+
+/***** Define *****/
+#define JUNCTION_STABLE 4 // Frames, 4ms at 1 frame per ms
+#define JUNCTION_RAM    (JUNCTION_STABLE + 5) // Bytes of globals below
+#define JUNCTION_BOX    60 // ms all on, longer than crossing a line
+
+#define SEN_SIDE  (SEN_LEFT | SEN_RIGHT)
+#define SEN_TRACK (SEN_MLEFT | SEN_MIDDLE | SEN_MRIGHT)
+#define SEN_ALL   (SEN_SIDE | SEN_TRACK)
+
+#define SHAPE_DEAD_END 0 // No exits
+#define SHAPE_LEFT     (1 << TURN_L)
+#define SHAPE_RIGHT    (1 << TURN_R)
+#define SHAPE_T        (SHAPE_LEFT | SHAPE_RIGHT)
+#define SHAPE_CROSS    (SHAPE_T | (1 << TURN_S))
+#define SHAPE_LEFT_S   (SHAPE_LEFT | (1 << TURN_S))
+#define SHAPE_RIGHT_S  (SHAPE_RIGHT | (1 << TURN_S))
+#define SHAPE_NONE     0x10 // Line, no junction
+#define SHAPE_BRANCH   0x20 // Side branch under the sensors, not decided yet
+#define SHAPE_FINISH   0x40
+
+/***** Junction function prototype *****/
+void junctionReset(void);
+uChar junctionClassify(uChar sensor);
+
+/***** Global variable *****/
+uChar junctionHistory[JUNCTION_STABLE]; // Last frames, ring buffer
+uChar junctionNext; // Oldest frame, overwritten next
+uChar junctionStable; // Debounced sensor bits
+uChar junctionSides; // SEN_SIDE bits seen on this branch
+uChar junctionCount; // Frames since the sides cleared, or all on
+uChar junctionPhase; // 0 line, 1 on the branch, 2 past the branch
+
+/***** Junction sub function *****/
+void junctionReset(void)
+{
+  uChar i;
+
+  for(i = 0; i < JUNCTION_STABLE; i++) junctionHistory[i] = SEN_MIDDLE;
+  junctionNext = 0;
+  junctionStable = SEN_MIDDLE;
+  junctionPhase = 0;
+}
+
+/* Returns SHAPE_NONE on the line, SHAPE_BRANCH while a branch is passed,
+ * then its shape once. SHAPE_DEAD_END is returned when all sensors are
+ * off, SHAPE_FINISH when all are on for JUNCTION_BOX ms. */
+uChar junctionClassify(uChar sensor)
+{
+  uChar i, on = SEN_ALL, seen = 0, shape;
+
+  junctionHistory[junctionNext] = sensor;
+  if(++junctionNext == JUNCTION_STABLE) junctionNext = 0;
+  for(i = 0; i < JUNCTION_STABLE; i++)
+  {
+    on &= junctionHistory[i];
+    seen |= junctionHistory[i];
+  }
+  junctionStable = (junctionStable | on) & seen; // Unchanged until stable
+
+  switch(junctionPhase)
+  {
+    case 0:
+      if(junctionStable & SEN_SIDE)
+      {
+        junctionSides = 0;
+        junctionCount = 0;
+        junctionPhase = 1;
+      }
+      else if(!junctionStable) return SHAPE_DEAD_END;
+      else return SHAPE_NONE;
+      // Fall through, frame is on the branch
+
+    case 1:
+      junctionSides |= junctionStable;
+      if(junctionStable == SEN_ALL)
+      {
+        if(++junctionCount >= JUNCTION_BOX)
+        {
+          junctionPhase = 0;
+          return SHAPE_FINISH;
+        }
+      }
+      else junctionCount = 0;
+      if(!(junctionStable & SEN_SIDE))
+      {
+        junctionCount = 0;
+        junctionPhase = 2;
+      }
+      break;
+
+    case 2: // Sides clear, the line ahead decides straight
+      if(junctionStable & SEN_SIDE) junctionSides |= junctionStable; // Wide branch
+      else if(++junctionCount >= JUNCTION_STABLE)
+      {
+        shape = 0;
+        if(junctionSides & SEN_LEFT) shape |= SHAPE_LEFT;
+        if(junctionSides & SEN_RIGHT) shape |= SHAPE_RIGHT;
+        if(junctionStable & SEN_TRACK) shape |= 1 << TURN_S;
+        junctionPhase = 0;
+        return shape;
+      }
+      break;
+  }
+  return SHAPE_BRANCH;
+}
+
+#endif
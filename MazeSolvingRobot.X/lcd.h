@@ -9,62 +9,201 @@
  * lcdPutchar('A');
  * lcdPutstr("Hello World");
  * lcdNumber(123,DEC,3);
+ *
+ * All of the above except lcdInit()
+ * only write lcdBuffer[], lcdRefresh()
+ * is called from the timer interrupt
+ * and sends one changed cell per tick.
  ***********************************/
 
 /***** Include files *****/
 #include "system.h"
+#include "portb.h"
 
 /***** Define *****/
-#define lcdPulse()      ((LCD_E=1), delayUs(2), (LCD_E=0), delayUs(2))
+#define LCD_ROWS        2 // 2x8, use 4 and 20 for a 4x20 LCD
+#define LCD_COLS        8
+#define LCD_SIZE        (LCD_ROWS * LCD_COLS)
+#define LCD_RAM         (2 * LCD_SIZE + 5) // Bytes of globals below
+
+#define LCD_T_EXEC      40 // us, 37us + margin for most instructions
+#define LCD_T_HOME      1640 // us, 1.52ms + margin for clear display, return home
+
+#define lcdPulse()      ((LCD_E=1), delayUs(1), (LCD_E=0)) // E high >= 230ns
 #define lcdConfig(x)    lcdWrite(0, x)
-#define lcdPutchar(x)   lcdWrite(1, x)
-#define lcdClear()      (lcdConfig(1), delayMs(2))
-#define lcdHome()       (lcdConfig(2), delayMs(2))
 
 /***** LCD function prototype *****/
 void lcdInit(void);
-void lcdWrite(char rs, uChar data);
+void lcdWrite(uChar rs, uChar data);
+void lcdClear(void);
+void lcdHome(void);
 void lcdGoto(uChar row, uChar col);
+void lcdPutchar(uChar data);
 void lcdPutstr(const char *s);
 void lcdNumber(uInt no, uChar base, uChar digit);
+void lcdRefresh(void);
+void lcdWaitBusy(void);
 
 /***** Global variable *****/
+const uChar lcdRowAddress[4] = {0x00, 0x40, 0x14, 0x54};
+
+volatile uChar lcdBuffer[LCD_SIZE]; // What the program wants on the LCD
+uChar lcdShown[LCD_SIZE]; // What the LCD is showing
+uChar lcdCursor, lcdRowEnd; // Next lcdBuffer cell and end of its row
+volatile uChar lcdDirty; // lcdBuffer changed since last refresh pass
+uChar lcdScan, lcdAddress; // Next cell to check, LCD address counter
+
+/***** Interrupt function *****/
+void lcdRefresh(void)
+{
+  uChar i, row, address, data;
+
+  if(!lcdScan) // Start of a refresh pass
+  {
+    if(!lcdDirty) return;
+    lcdDirty = 0;
+  }
+
+  for(i = lcdScan; i < LCD_SIZE; i++)
+  {
+    if(lcdBuffer[i] != lcdShown[i]) break;
+  }
+  if(i == LCD_SIZE)
+  {
+    lcdScan = 0;
+    return;
+  }
+  lcdScan = i;
+
+  row = 0;
+  address = i;
+  while(address >= LCD_COLS)
+  {
+    address -= LCD_COLS;
+    row++;
+  }
+  address += lcdRowAddress[row];
+
+  if(address != lcdAddress) // Move the LCD cursor first
+  {
+    PORTB_WRITE_ISR(LCD_RS, 0);
+    LCD_DATA = 0x80 | address;
+    lcdAddress = address;
+  }
+  else
+  {
+    data = lcdBuffer[i];
+    PORTB_WRITE_ISR(LCD_RS, LCD_RS);
+    LCD_DATA = data;
+    lcdShown[i] = data;
+    lcdAddress++;
+    lcdScan++;
+  }
+  LCD_E = 1; // Tick period covers the 40us execution time
+  LCD_E = 0;
+}
 
 /***** LCD sub function *****/
 void lcdInit(void)
 {
-  delayMs(20);
-  lcdConfig(0x30); // 8-bits function set
-  lcdConfig(0x30); // 8-bits function set
-  lcdConfig(0x30); // 8-bits function set
+  uChar i;
+
+#ifdef LCD_RW
+  LCD_RW = 0;
+#endif
+  delayMs(15); // Power on, Vcc > 4.5V
+  portbWrite(LCD_RS, 0); // Initialization by instruction, busy flag not valid yet
+  LCD_DATA = 0x30; // 8-bits function set
+  lcdPulse();
+  delayUs(4100);
+  lcdPulse();
+  delayUs(100);
+  lcdPulse();
+  delayUs(LCD_T_EXEC);
   lcdConfig(0x38); // 8-bits function set
   lcdConfig(0x0C); // Display ON/OFF control
   lcdConfig(0x01); // Clear screen
   lcdConfig(0x06); // Entry mode set
   lcdConfig(0x02); // Return to home
-  delayMs(2);
+
+  for(i = 0; i < LCD_SIZE; i++)
+  {
+    lcdBuffer[i] = ' ';
+    lcdShown[i] = ' ';
+  }
+  lcdCursor = 0;
+  lcdRowEnd = LCD_COLS;
+  lcdDirty = 0;
+  lcdScan = 0;
+  lcdAddress = 0x00;
 }
 
 void lcdWrite(uChar rs, uChar data)
 {
-  LCD_RS = rs;
+  portbWrite(LCD_RS, rs ? LCD_RS : 0);
   LCD_DATA = data;
   lcdPulse();
-  delayUs(40);
+#ifdef LCD_RW
+  lcdWaitBusy();
+#else
+  if(!rs && data < 0x04) delayUs(LCD_T_HOME); // Clear display, return home
+  else delayUs(LCD_T_EXEC);
+#endif
+}
+
+#ifdef LCD_RW
+void lcdWaitBusy(void)
+{
+  uChar busy, timeout = LCD_T_HOME / 10;
+
+  LCD_DATA_TRIS = 0xFF; // Data bus as input
+  portbWrite(LCD_RS, 0);
+  LCD_RW = 1; // Read busy flag
+  do
+  {
+    LCD_E = 1;
+    delayUs(1);
+    busy = LCD_BUSY;
+    LCD_E = 0;
+    delayUs(10);
+  }
+  while(busy && --timeout);
+  LCD_RW = 0;
+  LCD_DATA_TRIS = 0x00;
+}
+#endif
+
+void lcdClear(void)
+{
+  uChar i;
+  for(i = 0; i < LCD_SIZE; i++) lcdBuffer[i] = ' ';
+  lcdDirty = 1;
+  lcdHome();
+}
+
+void lcdHome(void)
+{
+  lcdCursor = 0;
+  lcdRowEnd = LCD_COLS;
 }
 
 void lcdGoto(uChar row, uChar col)
 {
-  switch(row)
+  if(row < 1 || row > LCD_ROWS || col < 1 || col > LCD_COLS)
+  {
+    lcdCursor = lcdRowEnd = 0; // Off screen, drop the characters
+    return;
+  }
+  lcdRowEnd = row * LCD_COLS;
+  lcdCursor = lcdRowEnd - LCD_COLS + col - 1;
+}
+
+void lcdPutchar(uChar data)
+{
+  if(lcdCursor < lcdRowEnd)
   {
-  case 1: lcdConfig(0x80 + col - 1);
-    break;
-  case 2: lcdConfig(0xC0 + col - 1);
-    break;
-  case 3: lcdConfig(0x94 + col - 1);
-    break;
-  case 4: lcdConfig(0xD4 + col - 1);
-    break;
+    lcdBuffer[lcdCursor++] = data;
+    lcdDirty = 1;
   }
 }
 
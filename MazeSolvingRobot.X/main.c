@@ -10,9 +10,17 @@
 
 /***** Include files *****/
 #include "system.h"
+#include "timer.h"
+#include "buzzer.h"
+#include "portb.h"
 #include "lcd.h"
 #include "uart.h"
 #include "pwm.h"
+#include "maze.h"
+#include "junction.h"
+#ifdef MAZE_LOOPED
+#include "graph.h"
+#endif
 
 /***** PIC special fuction configuration *****/
 #pragma config FOSC = INTRC_NOCLKOUT    // I/O function on RA6 & RA7
@@ -31,304 +39,288 @@ void picInit(void);
 void beep(uChar times, uInt delayMs);
 void wifiString(const char *s);
 void motor(sChar speedLM, sChar speedRM);
+void motorStop(uChar brakeMs);
+void pivot(uChar speed);
+uChar sensorRead(void);
+void lineTrack(uChar sensor);
+void junctionEnter(uChar state);
+uChar junctionChoose(uChar exits);
+void pathShow(void);
+void explore(void);
+void exploreStart(void);
+uChar exploreStep(uChar sensor);
+void exploreRecord(uChar dir);
+void exploreEnd(void);
+void arcTurn(uChar turn);
+
+/***** Define *****/
+#define JUNCTION_FOLLOW   0 // Exploration states, see exploreStep()
+#define JUNCTION_APPROACH 1
+#define JUNCTION_POSITION 2
+#define JUNCTION_ALIGN    3
+#define JUNCTION_TURN     4
+#define JUNCTION_SETTLE   5
+#define JUNCTION_RESUME   6
+#define JUNCTION_FINISH   7
+#define JUNCTION_LOST     8 // Pivot never found the line, exploration given up
+
+#define MOTOR_COAST 0 // motorStop() modes, else brake for that many ms then coast
+#define MOTOR_BRAKE 0xFF // Brake until the next motor() call
+#define BRAKE_MS    60 // Short brake, stops from exploration speed
+
+#define POSITION_MS 150 // Creep forward from the branch until the wheels are on it
+#define ALIGN_MS    80 // Stop before pivot, BRAKE_MS + settle
+#define TURN_MS     3000 // Pivot did not find the line, stop and pivot again
+#define TURN_TRIES  3 // Pivots before exploration is given up
+#define PIVOT_FAST  60 // Pivot speed until the outer sensor sees the new line
+#define PIVOT_SLOW  20 // Ramped down to, 1% per ms, until the inner sensor sees it
+#define PIVOT_BRAKE 30 // ms of brake at PIVOT_FAST, less when slower, centres senMiddle
+#define SETTLE_MS   80 // Stop after pivot, BRAKE_MS + settle
+#define RESUME_MS   300 // Ignore senLeft and senRight while leaving the junction
+
+#define REPLAY_SLOW 8 // Replay progress per ms with trackSpeed[], 70%
+#define REPLAY_FAST 11 // Replay progress per ms with trackFast[], 8 * 100 / 70
+#define REPLAY_BRAKE 6 // Slow down at 6/8 of the explored segment
+
+#define ARC_ENTRY    40 // Replay turn speed until the sensors pass the branch
+#define ARC_ENTRY_MS 150
+#define ARC_OUTER    60 // Replay turn wheel speeds, ratio sets the arc radius
+#define ARC_INNER    5
+#define ARC_MS       1500 // Arc did not find the line, follow the line again
+
+#define BUZZ_SHORT_ON  80 // Line follower buzzer pattern, ms, 4s in all
+#define BUZZ_SHORT_OFF 240
+#define BUZZ_LONG_ON   400
+#define BUZZ_LONG_OFF  3280
+
+/* RAM budget of the whole image. Globals of every module (the *_RAM
+ * figures) plus this file's MAIN_RAM must leave RAM_STACK of the
+ * PIC16F887's 368 bytes for the compiled stack, the interrupt context
+ * and compiler temporaries. Looped: 141 + 174 graph = 315 of 320. */
+#define RAM_SIZE  368
+#define RAM_STACK 48
+#define MAIN_RAM  15 // Bytes of globals below
+#ifdef MAZE_LOOPED
+#define RAM_GRAPH GRAPH_RAM
+#else
+#define RAM_GRAPH 0
+#endif
+#define RAM_USED  (TIMER_RAM + BUZZER_RAM + PORTB_RAM + LCD_RAM + UART_RAM + PATH_RAM + JUNCTION_RAM + RAM_GRAPH + MAIN_RAM)
+
+#if RAM_USED > RAM_SIZE - RAM_STACK
+#error "Globals leave too little RAM for the stack, reduce GRAPH_NODES or PATH_MAX"
+#endif
 
 /***** Global variable *****/
+/* Line follower speed {left, right} for every sensorRead() pattern */
+const sChar lineSpeed[32][2] =
+{
+  { 0,  0}, // 00000 line lost, keep last speed
+  {80,  0}, // 00001
+  {80, 30}, // 00010
+  {80, 10}, // 00011
+  {80, 80}, // 00100
+  {80, 30}, // 00101
+  {80, 40}, // 00110
+  {80, 30}, // 00111
+  {30, 80}, // 01000
+  {80, 40}, // 01001
+  {80, 80}, // 01010
+  {80, 40}, // 01011
+  {40, 80}, // 01100
+  {80, 40}, // 01101
+  {80, 80}, // 01110
+  {80, 40}, // 01111
+  { 0, 80}, // 10000
+  {80, 80}, // 10001
+  {40, 80}, // 10010
+  {80, 40}, // 10011
+  {30, 80}, // 10100
+  {80, 80}, // 10101
+  {40, 80}, // 10110
+  {80, 80}, // 10111
+  {10, 80}, // 11000
+  {40, 80}, // 11001
+  {40, 80}, // 11010
+  {80, 80}, // 11011
+  {30, 80}, // 11100
+  {80, 80}, // 11101
+  {40, 80}, // 11110
+  {80, 80}  // 11111
+};
+
+/* Maze tracking speed {left, right} for senMLeft, senMiddle, senMRight */
+const sChar trackSpeed[8][2] =
+{
+  { 0,  0}, // 000 line lost, keep last speed
+  {70, 30}, // 001
+  {70, 70}, // 010
+  {70, 40}, // 011
+  {30, 70}, // 100
+  {70, 70}, // 101
+  {40, 70}, // 110
+  {70, 70}  // 111
+};
+
+/* Replay speed {left, right} on a known straight, trackSpeed[] * 100 / 70 */
+const sChar trackFast[8][2] =
+{
+  {  0,   0}, // 000 line lost, keep last speed
+  {100,  43}, // 001
+  {100, 100}, // 010
+  {100,  57}, // 011
+  { 43, 100}, // 100
+  {100, 100}, // 101
+  { 57, 100}, // 110
+  {100, 100}  // 111
+};
+
+volatile uChar brakeTime; // ms of timed brake left, see motorStop()
+uChar junctionState, turnDir, turnOuter, turnLines, turnSpeed;
+uChar turnTries; // Pivots timed out at this junction
+uInt junctionTime; // ms in junctionState
+uInt junctionTotal; // ms spent outside JUNCTION_FOLLOW in this run
+uInt segmentTime; // ms since the robot left the last junction
+uInt segmentLast; // segmentTime when the next junction was found
+
+/***** Interrupt function *****/
+void interrupt isr(void)
+{
+  if(timerIsr()) // Timer0, every 1ms
+  {
+    buzzerIsr();
+    if(brakeTime && brakeTime != MOTOR_BRAKE && !--brakeTime) // Timed brake over, coast
+    {
+      PORTB_WRITE_ISR(MOTOR_PINS, 0);
+      CCPR1L = 0; // Duty 0, enable high with inputs 00 still brakes
+      CCPR2L = 0;
+      CCP1CON &= 0b11001111;
+      CCP2CON &= 0b11001111;
+    }
+    lcdRefresh();
+  }
+  uartIsr();
+}
 
 /***** Main function *****/
 void main(void)
 {
-  uInt i;
-  uChar path[20], pathLength = 0, pathTotal, dir = 0;
-  uChar simplified = 0, string[3];
-  uLong buzzerCount = 0;
+  uChar i, pathTotal, sensor, lastTick;
+  uInt progress;
 
   picInit();
+  timerInit();
+  pwmInit();
   lcdInit();
+  GIE = 1; // LCD is refreshed from the Timer0 interrupt
   beep(2, 50);
 
-  lcdClear();
-  lcdPutstr("SW1:Maze");
-  lcdGoto(2,1);
-  lcdPutstr("SW2:Line");
-
-  while(1)
+  if(!SW1 && pathLoad()) // SW1 held at power up, replay the stored path
   {
-    if(!SW1)
-    {
-      lcdClear();
-      lcdPutstr("  Maze  ");
-      lcdGoto(2,1);
-      lcdPutstr("Solving.");
-      delayMs(1000);
-      lcdClear();
-      lcdPutstr("Path:   ");
-      beep(1, 50);
-      break;
-    }
-    else if(!SW2)
-    {
-      lcdClear();
-      lcdPutstr("Line    ");
-      lcdGoto(2,1);
-      lcdPutstr("Follower");
-      beep(1, 50);
-      while(1)
-      {
-        buzzerCount++;
-        if(buzzerCount > 50000) buzzerCount = 0;
-        else if(buzzerCount > 10000) BUZZER = 0;
-        else if(buzzerCount > 5000) BUZZER = 1;
-        else if(buzzerCount > 2000) BUZZER = 0;
-        else if(buzzerCount > 1000) BUZZER = 1;
-        
-        if(!senLeft && !senMLeft && senMiddle && !senMRight && !senRight)
-        {
-          motor(80, 80);
-        }
-        else if(!senLeft && senMLeft && senMiddle && !senMRight && !senRight)
-        {
-          motor(40, 80);
-        }
-        else if(!senLeft && !senMLeft && senMiddle && senMRight && !senRight)
-        {
-          motor(80, 40);
-        }
-        else if(!senLeft && senMLeft && !senMiddle && !senMRight && !senRight)
-        {
-          motor(30, 80);
-        }
-        else if(!senLeft && !senMLeft && !senMiddle && senMRight && !senRight)
-        {
-          motor(80, 30);
-        }
-        else if(senLeft && senMLeft && !senMiddle && !senMRight && !senRight)
-        {
-          motor(10, 80);
-        }
-        else if(!senLeft && !senMLeft && !senMiddle && senMRight && senRight)
-        {
-          motor(80, 10);
-        }
-        else if(senLeft && !senMLeft && !senMiddle && !senMRight && !senRight)
-        {
-          motor(0, 80);
-        }
-        else if(!senLeft && !senMLeft && !senMiddle && !senMRight && senRight)
-        {
-          motor(80, 0);
-        }
-      }
-    }
+    lcdClear();
+    lcdPutstr("Stored  ");
+    pathShow();
+    beep(1, 50);
+    while(!SW1);
   }
-
-  while(1)
+  else
   {
-    if(!senMLeft && senMiddle && !senMRight)
-    {
-      motor(70, 70);
-    }
-    else if(senMLeft && senMiddle && !senMRight)
-    {
-      motor(40, 70);
-    }
-    else if(!senMLeft && senMiddle && senMRight)
-    {
-      motor(70, 40);
-    }
-    else if(senMLeft && !senMiddle && !senMRight)
-    {
-      motor(30, 70);
-    }
-    else if(!senMLeft && !senMiddle && senMRight)
-    {
-      motor(70, 30);
-    }
+    lcdClear();
+    lcdPutstr("SW1:Maze");
+    lcdGoto(2,1);
+    lcdPutstr("SW2:Line");
 
-    if(senRight && !senLeft)
+    while(1)
     {
-      motor(30, 30);
-      for(i = 0; i < 200; i++)
+      if(!SW1)
       {
-        if(senLeft) break;
-        delayMs(1);
+        lcdClear();
+        lcdPutstr("  Maze  ");
+        lcdGoto(2,1);
+        lcdPutstr("Solving.");
+        timerWait(1000);
+        lcdClear();
+        lcdPutstr("Path:   ");
+        beep(1, 50);
+        break;
       }
-      if(!senLeft)
+      else if(!SW2)
       {
-        motor(0, 0);
-        delayMs(200);
-        if(!senMiddle)
+        lcdClear();
+        lcdPutstr("Line    ");
+        lcdGoto(2,1);
+        lcdPutstr("Follower");
+        beep(1, 50);
+        while(1)
         {
-          dir = 'R';
-          motor(30, -30);
-          while(!senRight);
-//          motor(10, -10);
-          while(!senMRight);
-          motor(0, 0);
-          delayMs(200);
-        }
-        else dir = 'S';
-      }
-    }
-    if(senLeft)
-    {
-      motor(30, 30);
-      delayMs(200);
-      motor(0, 0);
-      delayMs(200);
-      dir = 'L';
-      motor(-30, 30);
-      while(!senLeft);
-//      motor(-10, 10);
-      while(!senMLeft);
-      motor(0, 0);
-      delayMs(200);
-    }
-
-    if(!senLeft && !senMLeft && !senMiddle && !senMRight && !senRight)
-    {
-      motor(0, 0);
-      delayMs(200);
-      dir = 'B';
-      motor(30, -30);
-      while(!senRight);
-//      motor(10, -10);
-      while(!senMRight);
-      motor(0, 0);
-      delayMs(200);
-    }
-
-    if(senLeft && senMLeft && senMiddle && senMRight && senRight)
-    {
-      motor(0, 0);
-      beep(3, 300);
-      pathTotal = pathLength;
-      lcdGoto(1, 6);
-      lcdNumber(pathTotal, DEC, 2);
-      break;
-    }
+          if(!buzzerBusy()) // Short beep, long beep, repeat
+          {
+            buzzerPlay(1, BUZZ_SHORT_ON, BUZZ_SHORT_OFF);
+            buzzerPlay(1, BUZZ_LONG_ON, BUZZ_LONG_OFF);
+          }
 
-    if(dir)
-    {
-      if(dir == 'B')
-      {
-        simplified = 1;
-        string[1] = dir; // 'B' always at the middle
-        lcdGoto(2, pathLength+1);
-        lcdPutchar(dir);
-        string[0] = path[--pathLength];
-        dir = 0;
-      }
-      else if(simplified)
-      {
-        string[2] = dir;
-        /*LBL = S, LBR = B, LBS = R, RBL = B, SBL = R, SBS = B*/
-        if(!memcmp("LBL", &string, 3)) path[pathLength] = 'S';
-        else if(!memcmp("LBR", &string, 3)) path[pathLength] = 'B';
-        else if(!memcmp("LBS", &string, 3)) path[pathLength] = 'R';
-        else if(!memcmp("RBL", &string, 3)) path[pathLength] = 'B';
-        else if(!memcmp("SBL", &string, 3)) path[pathLength] = 'R';
-        else if(!memcmp("SBS", &string, 3)) path[pathLength] = 'B';
-
-        lcdGoto(2, pathLength+1);
-        lcdPutchar(path[pathLength]);
-        lcdGoto(2, pathLength+2);
-        lcdPutchar(' ');
-
-        if(path[pathLength] == 'B')
-        {
-          string[1] = path[pathLength]; // 'B' always at the middle
-          string[0] = path[--pathLength];
-        }
-        else
-        {
-          simplified = 0;
-          pathLength++;
+          sensor = sensorRead();
+          if(sensor) motor(lineSpeed[sensor][0], lineSpeed[sensor][1]);
         }
-        dir = 0;
       }
-      else if(!simplified)
-      {
-        path[pathLength] = dir;
-        lcdGoto(2, pathLength+1);
-        lcdPutchar(path[pathLength]);
-        pathLength++;
-      }
-      dir = 0;
     }
+
+    explore();
+    if(pathLength) pathSave(); // Replay after power up with SW1 held, keep the old one if lost
   }
 
+  pathTotal = pathLength;
+  lcdGoto(1, 1);
+  lcdPutstr("Path:");
+  lcdNumber(pathTotal, DEC, 2);
+
   while(1)
   {
     if(!SW1)
     {
-      pathLength = 0;
+      i = 0;
+      progress = 0;
       beep(2, 50);
-      delayMs(1000);
+      timerWait(1000);
+      lastTick = (uChar) msTick;
       while(1)
       {
-        if(!senMLeft && senMiddle && !senMRight)
-        {
-          motor(70, 70);
-        }
-        else if(senMLeft && senMiddle && !senMRight)
-        {
-          motor(40, 70);
-        }
-        else if(!senMLeft && senMiddle && senMRight)
-        {
-          motor(70, 40);
-        }
-        else if(senMLeft && !senMiddle && !senMRight)
+        timerNext(&lastTick); // One step every 1ms
+
+        sensor = (sensorRead() >> 1) & 0b111;
+        if(progress < (uInt) pathGetTime(i) * (SEGMENT_UNIT * REPLAY_BRAKE))
         {
-          motor(30, 70);
+          if(sensor) motor(trackFast[sensor][0], trackFast[sensor][1]);
+          progress += REPLAY_FAST; // Known straight, run fast
         }
-        else if(!senMLeft && !senMiddle && senMRight)
+        else
         {
-          motor(70, 30);
+          if(sensor) motor(trackSpeed[sensor][0], trackSpeed[sensor][1]);
+          if(progress < 0xFF00) progress += REPLAY_SLOW; // Junction ahead
         }
 
-        if(pathLength < pathTotal)
+        if(i < pathTotal)
         {
           if(senLeft || senRight)
           {
-            if(path[pathLength] == 'L')
+            if(pathGet(i) == TURN_L || pathGet(i) == TURN_R)
             {
-              motor(30, 30);
-              delayMs(200);
-              motor(0, 0);
-              delayMs(200);
-              motor(-30, 30);
-              while(!senLeft);
-  //              motor(-10, 10);
-              while(!senMLeft);
-              motor(0, 0);
-              delayMs(200);
+              arcTurn(pathGet(i));
             }
-            else if(path[pathLength] == 'R')
-            {
-              motor(30, 30);
-              delayMs(200);
-              motor(0, 0);
-              delayMs(200);
-              motor(30, -30);
-              while(!senRight);
-  //              motor(-10, 10);
-              while(!senMRight);
-              motor(0, 0);
-              delayMs(200);
-            }
-            else if(path[pathLength] == 'S')
+            else if(pathGet(i) == TURN_S)
             {
               motor(30, 30);
               while(senLeft || senRight);
             }
-            pathLength++;
+            i++;
+            progress = 0;
+            lastTick = (uChar) msTick;
           }
         }
 
         if(senLeft && senMLeft && senMiddle && senMRight && senRight)
         {
-          motor(0, 0);
+          motorStop(BRAKE_MS);
           beep(10, 50);
           break;
         }
@@ -348,7 +340,8 @@ void picInit(void)
   ANSELH = 0;
 
   PORTA = 0; // Clear all pins at PORTA
-  PORTB = 0; // Clear all pins at PORTB
+  portbShadow = 0;
+  PORTB = portbShadow; // Clear all pins at PORTB
   PORTC = 0; // Clear all pins at PORTC
   PORTD = 0; // Clear all pins at PORTD
   PORTE = 0; // Clear all pins at PORTE
@@ -360,62 +353,386 @@ void picInit(void)
   TRISE = 0b011; // Set TRISE, 0:output, 1:input
 }
 
+/* Queues the beeps and returns, buzzer.h plays them */
 void beep(uChar times, uInt delayMs)
 {
-  uInt loop;
-  for(; times > 0; times--)
+  buzzerPlay(times, delayMs, delayMs);
+}
+
+void lineTrack(uChar sensor)
+{
+  sensor = (sensor >> 1) & 0b111; // senMLeft, senMiddle, senMRight
+  if(sensor) motor(trackSpeed[sensor][0], trackSpeed[sensor][1]);
+}
+
+void explore(void)
+{
+  uChar dir, lastTick;
+
+  exploreStart();
+  lastTick = (uChar) msTick;
+  while(junctionState != JUNCTION_FINISH && junctionState != JUNCTION_LOST)
   {
-    BUZZER = 1;
-    for(loop = 0; loop < delayMs; loop++) delayMs(1);
-    BUZZER = 0;
-    for(loop = 0; loop < delayMs; loop++) delayMs(1);
+    timerNext(&lastTick); // One step every 1ms
+    dir = exploreStep(sensorRead());
+    if(dir) exploreRecord(dir);
+  }
+  exploreEnd();
+
+  beep(3, 300);
+  lcdGoto(1, 1); // Junction time of this run for 2 seconds
+  lcdPutchar('J');
+  lcdNumber(junctionTotal, DEC, 5);
+  lcdPutstr("ms");
+  timerWait(2000);
+}
+
+/* explore() is split up without the loop and the LCD/buzzer at the
+ * end, so sim/maze_sim.c runs the same code on a simulated maze. */
+void exploreStart(void)
+{
+  pathClear();
+#ifdef MAZE_LOOPED
+  graphInit();
+#endif
+  junctionReset();
+  junctionEnter(JUNCTION_FOLLOW);
+  junctionTotal = 0;
+  segmentTime = 0;
+  turnTries = 0;
+}
+
+void exploreRecord(uChar dir)
+{
+#ifdef MAZE_LOOPED
+  lcdGoto(2, 1); // Junctions are in the graph, show how many
+  lcdPutstr("Nodes:");
+  lcdNumber(graphNodes, DEC, 2);
+#else
+  if(!pathAdd(turnCode(dir), segmentLast)) beep(1, 50); // Path full, xBy is reduced as it goes
+  pathShow();
+#endif
+}
+
+void exploreEnd(void)
+{
+  if(junctionState == JUNCTION_LOST) // A turn is missing, no path at all
+  {
+    pathClear();
+    lcdGoto(2, 1);
+    lcdPutstr("Lost    ");
+    beep(5, 50);
+    return;
+  }
+#ifdef MAZE_LOOPED
+  graphRoute(); // Shortest route through the explored nodes
+  if(!pathLength) beep(1, 50); // Graph full, no route
+  pathShow();
+#else
+  pathEnd(segmentLast);
+#endif
+}
+
+void pathShow(void)
+{
+  uChar i = 0;
+
+  if(pathLength > LCD_COLS) i = pathLength - LCD_COLS; // Last turns only
+  lcdGoto(2, 1);
+  for(; i < pathLength; i++) lcdPutchar(turnName[pathGet(i)]);
+  lcdPutstr("        "); // Clear the reduced turns, dropped at the end of the row
+}
+
+void junctionEnter(uChar state)
+{
+  junctionState = state;
+  junctionTime = 0;
+}
+
+/* Turn to take at a junction, exits is the junctionClassify() shape,
+ * bit TURN_L, TURN_S and TURN_R set for the branches seen. Returns 'L', 'S', 'R' or
+ * 'B', and the lines the pivot has to pass in turnLines. 0 when the graph
+ * has the shortest route and exploration is over. */
+uChar junctionChoose(uChar exits)
+{
+  uChar dir = 'B';
+
+#ifdef MAZE_LOOPED
+  dir = graphJunction(exits, segmentLast);
+  if(dir == GRAPH_DONE) return 0;
+  dir = turnName[dir];
+#else
+  if(exits & (1 << TURN_L)) dir = 'L'; // Left hand rule
+  else if(exits & (1 << TURN_S)) dir = 'S';
+  else if(exits) dir = 'R';
+#endif
+
+  turnLines = 1;
+  if(dir == 'B' && (exits & (1 << TURN_R))) turnLines = 2; // Pivot passes the right branch
+  return dir;
+}
+
+/* One step of exploration, called every 1ms with sensorRead().
+ * FOLLOW   track the line until junctionClassify() sees a branch or a dead end
+ * APPROACH track the line over the branch until its shape is known
+ * POSITION creep forward until the wheels are on the junction
+ * ALIGN    stop before the pivot
+ * TURN     pivot fast until the outer sensor sees the line, ramp down until
+ *          the inner one sees it and brake, turnLines lines for 'B' past a
+ *          right branch, after TURN_MS stop and pivot again from ALIGN,
+ *          LOST after TURN_TRIES
+ * SETTLE   stop after the pivot
+ * RESUME   track the line until senLeft/senRight clear the junction
+ * Returns the turn taken ('L', 'R', 'S', 'B') once it is done, else 0. */
+uChar exploreStep(uChar sensor)
+{
+  uChar dir = 0, shape;
+
+  junctionTime++;
+  segmentTime++;
+  if(junctionState != JUNCTION_FOLLOW) junctionTotal++;
+
+  switch(junctionState)
+  {
+    case JUNCTION_FOLLOW:
+      shape = junctionClassify(sensor);
+      if(shape == SHAPE_DEAD_END) // Turn back
+      {
+        segmentLast = segmentTime;
+        motorStop(BRAKE_MS);
+        turnDir = junctionChoose(SHAPE_DEAD_END);
+        junctionEnter(turnDir ? JUNCTION_ALIGN : JUNCTION_FINISH);
+        break;
+      }
+      if(shape == SHAPE_BRANCH)
+      {
+        segmentLast = segmentTime;
+        junctionEnter(JUNCTION_APPROACH);
+      }
+      lineTrack(sensor);
+      break;
+
+    case JUNCTION_APPROACH:
+      shape = junctionClassify(sensor);
+      if(shape == SHAPE_BRANCH) // Not known yet, keep the speed
+      {
+        lineTrack(sensor);
+        break;
+      }
+      if(shape == SHAPE_FINISH)
+      {
+        motorStop(BRAKE_MS);
+#ifdef MAZE_LOOPED
+        if(graphFinish(segmentLast) != GRAPH_DONE) // A shorter route may be left, back out
+        {
+          turnDir = 'B';
+          turnLines = 2; // The box is passed like a right branch
+          junctionEnter(JUNCTION_ALIGN);
+          break;
+        }
+#endif
+        junctionEnter(JUNCTION_FINISH);
+        break;
+      }
+      turnDir = junctionChoose(shape);
+      if(!turnDir) // Route known, stop here
+      {
+        motorStop(BRAKE_MS);
+        junctionEnter(JUNCTION_FINISH);
+        break;
+      }
+      if(turnDir == 'S')
+      {
+        dir = 'S';
+        segmentTime = 0;
+        junctionEnter(JUNCTION_RESUME);
+        break;
+      }
+      motor(30, 30);
+      junctionEnter(JUNCTION_POSITION);
+      break;
+
+    case JUNCTION_POSITION:
+      if(junctionTime < POSITION_MS) break;
+      motorStop(BRAKE_MS);
+      junctionEnter(JUNCTION_ALIGN);
+      break;
+
+    case JUNCTION_ALIGN:
+      if(junctionTime < ALIGN_MS) break;
+      turnSpeed = PIVOT_FAST;
+      pivot(turnSpeed);
+      turnOuter = 0;
+      junctionEnter(JUNCTION_TURN);
+      break;
+
+    case JUNCTION_TURN:
+      if(!turnOuter)
+      {
+        if(sensor & ((turnDir == 'L') ? SEN_LEFT : SEN_RIGHT)) turnOuter = 1;
+      }
+      else if(turnOuter == 2) // Passing a branch, wait until it is clear
+      {
+        if(!(sensor & (SEN_RIGHT | SEN_MRIGHT)))
+        {
+          turnOuter = 0;
+          turnSpeed = PIVOT_FAST;
+          pivot(turnSpeed);
+        }
+      }
+      else if(sensor & ((turnDir == 'L') ? SEN_MLEFT : SEN_MRIGHT))
+      {
+        if(--turnLines)
+        {
+          turnOuter = 2;
+          break;
+        }
+        motorStop((uInt) PIVOT_BRAKE * turnSpeed / PIVOT_FAST); // Stops with senMiddle on the line
+        dir = turnDir;
+        turnTries = 0;
+        junctionEnter(JUNCTION_SETTLE);
+        break;
+      }
+      else if(turnSpeed > PIVOT_SLOW) pivot(--turnSpeed); // Line is close, slow down
+      if(junctionTime >= TURN_MS) // Line lost, stop and pivot again
+      {
+        motorStop(BRAKE_MS);
+        if(++turnTries < TURN_TRIES) junctionEnter(JUNCTION_ALIGN);
+        else junctionEnter(JUNCTION_LOST); // The path would not match the maze
+      }
+      break;
+
+    case JUNCTION_SETTLE:
+      if(junctionTime >= SETTLE_MS)
+      {
+        segmentTime = 0;
+        junctionEnter(JUNCTION_RESUME);
+      }
+      break;
+
+    case JUNCTION_RESUME:
+      lineTrack(sensor);
+      if(!(sensor & (SEN_LEFT | SEN_RIGHT)) || junctionTime >= RESUME_MS)
+      {
+        junctionReset(); // Frames from the turn are not history of the line
+        junctionEnter(JUNCTION_FOLLOW);
+      }
+      break;
+  }
+  return dir;
+}
+
+/* Replay turn without stopping: keep going until the sensors pass the
+ * branch, arc until the outer then the inner sensor is on the new line,
+ * and let the line follower take over again. */
+void arcTurn(uChar turn)
+{
+  uChar outer = SEN_RIGHT, inner = SEN_MRIGHT, sensor, lastTick, seen = 0;
+  uInt time = 0;
+
+  if(turn == TURN_L)
+  {
+    outer = SEN_LEFT;
+    inner = SEN_MLEFT;
+  }
+
+  motor(ARC_ENTRY, ARC_ENTRY);
+  lastTick = (uChar) msTick;
+  while(time < ARC_ENTRY_MS) // Sensors over the branch
+  {
+    timerNext(&lastTick);
+    time++;
+    if(!(sensorRead() & outer)) break;
+  }
+
+  if(turn == TURN_L) motor(ARC_INNER, ARC_OUTER);
+  else motor(ARC_OUTER, ARC_INNER);
+  while(time < ARC_MS)
+  {
+    timerNext(&lastTick);
+    time++;
+    sensor = sensorRead();
+    if(sensor & outer) seen = 1;
+    else if(seen && (sensor & inner)) break; // On the new line
   }
 }
 
 void motor(sChar speedLM, sChar speedRM)
 {
-  uChar speed, maxSpeed = 80;
+  uChar speedL, speed, dir = 0, maxSpeed = 100;
+
+  brakeTime = 0; // Cancel a timed brake
 
   if(speedLM < 0) // if speedLM is (-) value
   {
-    motorLeftA = 1; // Left motor rotate backward
-    motorLeftB = 0;
+    dir |= MOTOR_LEFT_A; // Left motor rotate backward
     speed = (-1) * speedLM; // Change the (-) to (+) value
   }
   else if(speedLM > 0) // if speedLM is (+) value
   {
-    motorLeftA = 0; // Left motor rotate forward
-    motorLeftB = 1;
+    dir |= MOTOR_LEFT_B; // Left motor rotate forward
     speed = speedLM;
   }
-  else if(!speedLM) // if speedLM is null
+  else if(!speedLM) // if speedLM is null, left motor stop
   {
-    motorLeftA = 0; // Left motor stop
-    motorLeftB = 0;
     speed = speedLM;
   }
   if(speed > maxSpeed) speed = maxSpeed; // Limit the speed
-  setPwmRC1(1000, speed); // Set freq = 1000, duty cycle = speed
+  speedL = speed;
 
   if(speedRM < 0) // if speedRM is (-) value
   {
-    motorRightA = 1; // Right motor rotate backward
-    motorRightB = 0;
+    dir |= MOTOR_RIGHT_A; // Right motor rotate backward
     speed = (-1) * speedRM; // Change the (-) to (+) value
   }
   else if(speedRM > 0) // if speedRM is (+) value
   {
-    motorRightA = 0; // Right motor rotate forward
-    motorRightB = 1;
+    dir |= MOTOR_RIGHT_B; // Right motor rotate forward
     speed = speedRM;
   }
-  else if(!speedRM) // if speedRM is numm
+  else if(!speedRM) // if speedRM is numm, right motor stop
   {
-    motorRightA = 0; // Right motor stop
-    motorRightB = 0;
     speed = speedRM;
   }
   if(speed > maxSpeed) speed = maxSpeed; // Limit the speed
-  setPwmRC2(1000, speed); // Set freq = 1000, duty cycle = speed
+
+  portbWrite(MOTOR_PINS, dir); // Both motors change direction at once
+  pwmSetDuty(PWM_RC1, speedL); // Duty cycle = speed
+  pwmSetDuty(PWM_RC2, speed);
 }
 
+/* Stop both motors. MOTOR_COAST lets them run down, MOTOR_BRAKE shorts
+ * them through the L293 (both inputs high, enable high) until the next
+ * motor() call, 1 to 254 brakes for that many ms then coasts. */
+void motorStop(uChar brakeMs)
+{
+  brakeTime = 0;
+  if(brakeMs == MOTOR_COAST)
+  {
+    motor(0, 0);
+    return;
+  }
+  portbWrite(MOTOR_PINS, MOTOR_PINS); // Both motors brake
+  pwmSetDuty(PWM_RC1, 100); // Enable high, PWM off time would coast
+  pwmSetDuty(PWM_RC2, 100);
+  brakeTime = brakeMs; // Timer0 coasts when it runs out
+}
+
+/* Pivot on the spot for turnDir, 'R' and 'B' clockwise */
+void pivot(uChar speed)
+{
+  if(turnDir == 'L') motor(-speed, speed);
+  else motor(speed, -speed);
+}
+
+uChar sensorRead(void)
+{
+  uChar portA = PORTA, portE = PORTE, sensor = 0; // Sample all sensors at once
+
+  if(portA & 0b00001000) sensor |= SEN_LEFT; // senLeft = RA3
+  if(portA & 0b00010000) sensor |= SEN_MLEFT; // senMLeft = RA4
+  if(portA & 0b00100000) sensor |= SEN_MIDDLE; // senMiddle = RA5
+  if(portE & 0b00000001) sensor |= SEN_MRIGHT; // senMRight = RE0
+  if(portE & 0b00000010) sensor |= SEN_RIGHT; // senRight = RE1
+  return sensor;
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#ifndef MAZE_H
+#define	MAZE_H
+
+/***********************************
+ * pathClear();
+ * pathAdd(TURN_L, 1500);      // Turn after 1500ms, reduces xBy, 0 if full
+ * pathEnd(800);               // Time from the last turn to the finish
+ * pathGet(0);                 // TURN_S, TURN_R, TURN_B or TURN_L
+ * pathGetTime(0);             // Segment time before turn 0, SEGMENT_UNIT ms
+ * turnName[pathGet(0)];       // 'S', 'R', 'B' or 'L'
+ * pathSave();                 // To data EEPROM
+ * pathLoad();                 // 0 if EEPROM has no valid path
+ *
+ * Turns are 2-bit codes, 4 per byte.
+ * The code is the turn angle / 90,
+ * so xBy reduces to (x + 2 + y) & 3.
+ * Segment times are 4-bit, 2 per byte.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+
+/***** Define *****/
+#ifdef MAZE_LOOPED
+#define PATH_MAX  12 // graph.h route, GRAPH_NODES - 2 turns at most
+#else
+#define PATH_MAX  128 // Turns, multiple of 4
+#endif
+#define PATH_RAM  (PATH_MAX / 4 + PATH_MAX / 2 + 2) // Bytes of globals below
+#define SEGMENT_UNIT 128 // ms per pathGetTime() step, 15 steps max
+
+#define TURN_S    0 // Straight
+#define TURN_R    1 // Right, 90 degree
+#define TURN_B    2 // Back, 180 degree
+#define TURN_L    3 // Left, 270 degree
+#define PATH_KEEP 0xFF // pathReduce[] entry for no reduction
+
+#define PATH_EEPROM 0x00 // EEPROM address: magic, length, pathData[], pathTime[], checksum
+#define PATH_MAGIC  0xA5
+
+/***** Maze function prototype *****/
+void pathClear(void);
+uChar pathGet(uChar index);
+void pathPut(uChar index, uChar turn);
+uChar pathAdd(uChar turn, uInt ms);
+void pathEnd(uInt ms);
+uChar pathGetTime(uChar index);
+void pathPutTime(uChar index, uInt ms);
+uChar turnCode(uChar name);
+void pathSave(void);
+uChar pathLoad(void);
+uChar pathChecksum(void);
+
+/***** Global variable *****/
+const char turnName[4] = {'S', 'R', 'B', 'L'};
+
+/* Reduction of the last 3 turns, index = first << 4 | middle << 2 | last */
+const uChar pathReduce[64] =
+{
+  PATH_KEEP, // SSS
+  PATH_KEEP, // SSR
+  PATH_KEEP, // SSB
+  PATH_KEEP, // SSL
+  PATH_KEEP, // SRS
+  PATH_KEEP, // SRR
+  PATH_KEEP, // SRB
+  PATH_KEEP, // SRL
+  TURN_B,    // SBS
+  TURN_L,    // SBR
+  TURN_S,    // SBB
+  TURN_R,    // SBL
+  PATH_KEEP, // SLS
+  PATH_KEEP, // SLR
+  PATH_KEEP, // SLB
+  PATH_KEEP, // SLL
+  PATH_KEEP, // RSS
+  PATH_KEEP, // RSR
+  PATH_KEEP, // RSB
+  PATH_KEEP, // RSL
+  PATH_KEEP, // RRS
+  PATH_KEEP, // RRR
+  PATH_KEEP, // RRB
+  PATH_KEEP, // RRL
+  TURN_L,    // RBS
+  TURN_S,    // RBR
+  TURN_R,    // RBB
+  TURN_B,    // RBL
+  PATH_KEEP, // RLS
+  PATH_KEEP, // RLR
+  PATH_KEEP, // RLB
+  PATH_KEEP, // RLL
+  PATH_KEEP, // BSS
+  PATH_KEEP, // BSR
+  PATH_KEEP, // BSB
+  PATH_KEEP, // BSL
+  PATH_KEEP, // BRS
+  PATH_KEEP, // BRR
+  PATH_KEEP, // BRB
+  PATH_KEEP, // BRL
+  TURN_S,    // BBS
+  TURN_R,    // BBR
+  TURN_B,    // BBB
+  TURN_L,    // BBL
+  PATH_KEEP, // BLS
+  PATH_KEEP, // BLR
+  PATH_KEEP, // BLB
+  PATH_KEEP, // BLL
+  PATH_KEEP, // LSS
+  PATH_KEEP, // LSR
+  PATH_KEEP, // LSB
+  PATH_KEEP, // LSL
+  PATH_KEEP, // LRS
+  PATH_KEEP, // LRR
+  PATH_KEEP, // LRB
+  PATH_KEEP, // LRL
+  TURN_R,    // LBS
+  TURN_B,    // LBR
+  TURN_L,    // LBB
+  TURN_S,    // LBL
+  PATH_KEEP, // LLS
+  PATH_KEEP, // LLR
+  PATH_KEEP, // LLB
+  PATH_KEEP  // LLL
+};
+
+uChar pathData[PATH_MAX / 4];
+uChar pathTime[PATH_MAX / 2 + 1]; // Segment before each turn, then to the finish
+uChar pathLength;
+
+/***** Maze sub function *****/
+void pathClear(void)
+{
+  pathLength = 0;
+}
+
+uChar pathGet(uChar index)
+{
+  return (pathData[index >> 2] >> ((index & 3) << 1)) & 3;
+}
+
+void pathPut(uChar index, uChar turn)
+{
+  uChar shift = (index & 3) << 1;
+  pathData[index >> 2] = (pathData[index >> 2] & ~(3 << shift)) | (turn << shift);
+}
+
+uChar pathGetTime(uChar index)
+{
+  if(index & 1) return pathTime[index >> 1] >> 4;
+  return pathTime[index >> 1] & 0x0F;
+}
+
+void pathPutTime(uChar index, uInt ms)
+{
+  uChar time = 15;
+
+  if(ms < 15 * SEGMENT_UNIT) time = ms / SEGMENT_UNIT; // Round down, replay brakes early
+  if(index & 1) pathTime[index >> 1] = (pathTime[index >> 1] & 0x0F) | (time << 4);
+  else pathTime[index >> 1] = (pathTime[index >> 1] & 0xF0) | time;
+}
+
+uChar pathAdd(uChar turn, uInt ms)
+{
+  uChar reduced;
+
+  if(pathLength >= PATH_MAX) return 0; // Full, turn is lost
+  pathPutTime(pathLength, ms);
+  pathPut(pathLength++, turn);
+
+  while(pathLength >= 3) // Replace xBy by one turn
+  {
+    reduced = pathReduce[(pathGet(pathLength - 3) << 4)
+                       | (pathGet(pathLength - 2) << 2)
+                       | pathGet(pathLength - 1)];
+    if(reduced == PATH_KEEP) break;
+    pathLength -= 2;
+    pathPut(pathLength - 1, reduced); // Same junction as x, keeps its time
+  }
+  return 1;
+}
+
+void pathEnd(uInt ms)
+{
+  pathPutTime(pathLength, ms); // pathTime[] has room for PATH_MAX + 1
+}
+
+uChar turnCode(uChar name)
+{
+  uChar i;
+  for(i = 0; i < 4; i++)
+  {
+    if(turnName[i] == name) break;
+  }
+  return i & 3;
+}
+
+uChar pathChecksum(void)
+{
+  uChar i, sum = pathLength;
+  for(i = 0; i < (pathLength + 3) / 4; i++) sum += pathData[i];
+  for(i = 0; i < pathLength / 2 + 1; i++) sum += pathTime[i];
+  return ~sum;
+}
+
+void pathSave(void)
+{
+  uChar i, address = PATH_EEPROM + 2;
+
+  eeprom_write(PATH_EEPROM, 0xFF); // Invalid until the checksum is written
+  eeprom_write(PATH_EEPROM + 1, pathLength);
+  for(i = 0; i < (pathLength + 3) / 4; i++) eeprom_write(address++, pathData[i]);
+  for(i = 0; i < pathLength / 2 + 1; i++) eeprom_write(address++, pathTime[i]);
+  eeprom_write(address, pathChecksum());
+  eeprom_write(PATH_EEPROM, PATH_MAGIC);
+}
+
+uChar pathLoad(void)
+{
+  uChar i, address = PATH_EEPROM + 2;
+
+  if(eeprom_read(PATH_EEPROM) != PATH_MAGIC) return 0;
+  pathLength = eeprom_read(PATH_EEPROM + 1);
+  if(pathLength > PATH_MAX)
+  {
+    pathLength = 0;
+    return 0;
+  }
+  for(i = 0; i < (pathLength + 3) / 4; i++) pathData[i] = eeprom_read(address++);
+  for(i = 0; i < pathLength / 2 + 1; i++) pathTime[i] = eeprom_read(address++);
+  if(eeprom_read(address) != pathChecksum())
+  {
+    pathLength = 0;
+    return 0;
+  }
+  return 1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PORTB_H
+#define	PORTB_H
+
+/***********************************
+ * portbWrite(MOTOR_PINS, MOTOR_LEFT_B | MOTOR_RIGHT_B);
+ * PORTB_WRITE_ISR(PORTB_BUZZER, 0); // In the interrupt
+ *
+ * Motor direction, LCD RS and the
+ * buzzer share PORTB. Their bits are
+ * changed in portbShadow and the whole
+ * byte is written to the port at once,
+ * no read-modify-write of the pins.
+ * The interrupt writes through the
+ * shadow too, portbWrite() holds it
+ * off while the shadow is updated.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+
+/***** Define *****/
+#define PORTB_RAM 1 // Bytes of globals below
+#define PORTB_WRITE_ISR(mask, value) (PORTB = portbShadow = (portbShadow & ~(mask)) | ((value) & (mask)))
+
+/***** PORTB function prototype *****/
+void portbWrite(uChar mask, uChar value);
+
+/***** Global variable *****/
+uChar portbShadow; // Last value written to PORTB
+
+/***** PORTB sub function *****/
+void portbWrite(uChar mask, uChar value)
+{
+  uChar gie = GIE;
+
+  GIE = 0;
+  portbShadow = (portbShadow & ~mask) | (value & mask);
+  PORTB = portbShadow;
+  GIE = gie;
+}
+
+#endif
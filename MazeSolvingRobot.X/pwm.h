@@ -1,34 +1,67 @@
 #ifndef PWM_H
 #define	PWM_H
 
+/***********************************
+ * pwmInit();
+ * pwmSetDuty(PWM_RC1, 50);
+ * pwmSetDuty(PWM_RC2, 50);
+ ***********************************/
+
 /***** Include files *****/
 #include "system.h"
 
+/***** Define *****/
+#define PWM_FREQ  1000 // PWM frequency (Hz), Timer2 prescale = 16
+#define PWM_PR2   ((_XTAL_FREQ / (4 * 16)) / PWM_FREQ - 1)
+#define PWM_STEP  ((4UL * (PWM_PR2 + 1) * 64 + 50) / 100) // 10-bit duty per 1%, x64
+#define PWM_SCALE ((uInt) PWM_STEP) // uInt, duty * PWM_SCALE stays a 16-bit multiply
+
+#define PWM_RC1   0 // CCP2 output
+#define PWM_RC2   1 // CCP1 output
+
+#if PWM_PR2 > 255
+#error "PWM_FREQ too low for Timer2 prescale 16"
+#endif
+
+#if PWM_STEP * 100 > 0xFFFF
+#error "PWM_SCALE too large for a 16-bit duty multiply"
+#endif
+
 /***** PWM Function Prototype *****/
-void setPwmRC1(int freq, int duty);
-void setPwmRC2(int freq, int duty);
+void pwmInit(void);
+void pwmSetDuty(uChar channel, uChar duty);
 
 /***** PWM Sub Function *****/
-void setPwmRC1(int freq, int duty)
+void pwmInit(void)
 {
-  int a;
-  T2CON = 0b00000111;
+  PR2 = PWM_PR2;
+  CCPR1L = 0; // Duty cycle = 0
+  CCPR2L = 0;
+  CCP1CON = 0b00001100; // PWM mode
   CCP2CON = 0b00001100;
-  PR2 = (_XTAL_FREQ / (4 * 16)) / (freq) - 1;
-  a = (PR2 + 1) * duty / 25;
-  CCPR2L = a / 4;
-  CCP2CON = (CCP2CON & 0b11001111) | ((a % 4) << 4);
+  T2CON = 0b00000111; // Timer2 ON, prescale = 16
 }
 
-void setPwmRC2(int freq, int duty)
+void pwmSetDuty(uChar channel, uChar duty)
 {
-  int a;
-  T2CON = 0b00000111;
-  CCP1CON = 0b00001100;
-  PR2 = (_XTAL_FREQ / (4 * 16)) / (freq) - 1;
-  a = (PR2 + 1) * duty / 25;
-  CCPR1L = a / 4;
-  CCP1CON = (CCP1CON & 0b11001111) | ((a % 4) << 4);
+  uInt a;
+  uChar lsb;
+
+  if(duty > 100) duty = 100;
+  a = ((uInt) duty * PWM_SCALE) >> 6; // 10-bit duty, no division
+  lsb = ((uChar) a << 4) & 0b00110000;
+  a >>= 2;
+
+  if(channel == PWM_RC1)
+  {
+    CCPR2L = a;
+    CCP2CON = (CCP2CON & 0b11001111) | lsb;
+  }
+  else
+  {
+    CCPR1L = a;
+    CCP1CON = (CCP1CON & 0b11001111) | lsb;
+  }
 }
 
-#endif
\ No newline at end of file
+#endif
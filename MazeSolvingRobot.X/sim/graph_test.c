@@ -0,0 +1,272 @@
+/*******************************************************
+ *  Title: Host test for graph.h (looped maze solving)
+ *  Build: make, needs gcc
+ *
+ *  Generates random looped line mazes on a grid, the
+ *  finish box at a dead end, lets graph.h explore them
+ *  the way the robot does (junction exits and segment
+ *  times with noise), then checks for every maze:
+ *  - exploration finds the finish and ends,
+ *  - every junction is one node (loops are closed),
+ *  - the replay path drives from start to finish,
+ *  - its length is the true shortest route.
+ *  Any failure fails the test.
+ *******************************************************/
+
+/***** Include files *****/
+#include <stdio.h>
+#include <stdlib.h>
+#include "system.h"
+#include "../maze.h"
+#include "../graph.h"
+
+/***** Define *****/
+#define COLS      3 // Grid junctions, 12 + start fits GRAPH_NODES
+#define ROWS      4
+#define VERTS     (COLS * ROWS + 1) // Last one is the start, below column 0
+#define START     (VERTS - 1)
+#define MS_UNIT   1000 // Exploration ms per length unit
+#define NOISE     4 // Segment time noise, +/- %
+#define MAZES     2000
+#define MAX_STEPS 400
+
+/***** Global variable *****/
+int posX[VERTS], posY[VERTS]; // Length units
+int link[VERTS][4]; // Vertex through each heading, -1 if none
+int finish;
+
+/***** Maze generator *****/
+int vertex(int c, int r)
+{
+  if(c < 0 || c >= COLS || r < 0 || r >= ROWS) return -1;
+  return r * COLS + c;
+}
+
+void connect(int a, int h, int b)
+{
+  link[a][h] = b;
+  link[b][(h + 2) & 3] = a;
+}
+
+void carve(int v, char *seen)
+{
+  int order[4] = {0, 1, 2, 3}, i, j, t, c, r, n;
+
+  seen[v] = 1;
+  for(i = 3; i > 0; i--) // Random order
+  {
+    j = rand() % (i + 1);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for(i = 0; i < 4; i++)
+  {
+    c = v % COLS + graphDx[order[i]];
+    r = v / COLS + graphDy[order[i]];
+    n = vertex(c, r);
+    if(n >= 0 && !seen[n])
+    {
+      connect(v, order[i], n);
+      carve(n, seen);
+    }
+  }
+}
+
+int degree(int v)
+{
+  int h, n = 0;
+  for(h = 0; h < 4; h++) n += link[v][h] >= 0;
+  return n;
+}
+
+void generate(int loops)
+{
+  char seen[VERTS] = {0};
+  int i, v, h, n, x, y;
+
+  /* Uneven spacing, segments of 1 to 3 units */
+  x = 0;
+  for(i = 0; i < COLS; i++)
+  {
+    for(v = i; v < COLS * ROWS; v += COLS) posX[v] = x;
+    x += 1 + rand() % 3;
+  }
+  y = 0;
+  for(i = 0; i < ROWS; i++)
+  {
+    for(v = i * COLS; v < (i + 1) * COLS; v++) posY[v] = y;
+    y += 1 + rand() % 3;
+  }
+  posX[START] = 0;
+  posY[START] = -1 - rand() % 2;
+
+  for(v = 0; v < VERTS; v++) for(h = 0; h < 4; h++) link[v][h] = -1;
+  carve(0, seen);
+  connect(START, 0, 0);
+
+  do finish = 1 + rand() % (COLS * ROWS - 1); // Finish box at a dead end
+  while(degree(finish) != 1);
+
+  for(i = 0; loops && i < 1000; i++) // Extra walls removed, each one makes a loop
+  {
+    v = rand() % (COLS * ROWS);
+    h = rand() % 4;
+    n = vertex(v % COLS + graphDx[h], v / COLS + graphDy[h]);
+    if(n < 0 || link[v][h] >= 0 || v == finish || n == finish) continue;
+    connect(v, h, n);
+    loops--;
+  }
+}
+
+int length(int a, int b)
+{
+  return abs(posX[a] - posX[b]) + abs(posY[a] - posY[b]);
+}
+
+/* Drive from v along heading h to the next junction the sensors notice:
+ * a side branch, a corner, a dead end or the finish. */
+int drive(int v, int h, int *units)
+{
+  *units = 0;
+  while(1)
+  {
+    *units += length(v, link[v][h]);
+    v = link[v][h];
+    if(v == finish) return v;
+    if(link[v][(h + 1) & 3] >= 0 || link[v][(h + 3) & 3] >= 0) return v;
+    if(link[v][h] < 0) return v; // Dead end
+  }
+}
+
+/* Shortest route in length units, Dijkstra over all vertices */
+int shortest(void)
+{
+  int dist[VERTS], done[VERTS] = {0}, i, h, n;
+
+  for(i = 0; i < VERTS; i++) dist[i] = 1 << 30;
+  dist[START] = 0;
+  while(1)
+  {
+    n = -1;
+    for(i = 0; i < VERTS; i++)
+    {
+      if(!done[i] && (n < 0 || dist[i] < dist[n])) n = i;
+    }
+    if(n < 0 || n == finish) break;
+    done[n] = 1;
+    for(h = 0; h < 4; h++)
+    {
+      i = link[n][h];
+      if(i >= 0 && dist[n] + length(n, i) < dist[i]) dist[i] = dist[n] + length(n, i);
+    }
+  }
+  return dist[finish];
+}
+
+uInt noisy(int units)
+{
+  return units * MS_UNIT * (100 - NOISE + rand() % (2 * NOISE + 1)) / 100;
+}
+
+/***** Main function *****/
+int main(void)
+{
+  int maze, v, h, t, units, walked, route, best, steps, i;
+  int failed = 0, loops;
+  double explored = 0;
+  char isNode[VERTS];
+  int nodes;
+
+  srand(1);
+  for(maze = 0; maze < MAZES; maze++)
+  {
+    loops = 1 + maze % 4;
+    generate(loops);
+    best = shortest();
+
+    /* Explore, past the finish until graph.h has the shortest route */
+    graphInit();
+    for(i = 0; i < VERTS; i++) isNode[i] = 0;
+    isNode[START] = 1;
+    nodes = 1;
+    v = START;
+    h = 0;
+    walked = 0;
+    for(steps = 0; steps < MAX_STEPS; steps++)
+    {
+      v = drive(v, h, &units);
+      walked += units;
+      if(!isNode[v])
+      {
+        isNode[v] = 1;
+        nodes++;
+      }
+      if(v == finish) t = graphFinish(noisy(units));
+      else
+      {
+        t = 0;
+        if(link[v][(h + 3) & 3] >= 0) t |= 1 << TURN_L;
+        if(link[v][h] >= 0) t |= 1 << TURN_S;
+        if(link[v][(h + 1) & 3] >= 0) t |= 1 << TURN_R;
+        t = graphJunction(t, noisy(units));
+      }
+      if(t == GRAPH_DONE) break;
+      h = (h + t) & 3;
+      if(link[v][h] < 0)
+      {
+        printf("maze %d: turn %c into a wall\n", maze, turnName[t]);
+        break;
+      }
+    }
+    if(t != GRAPH_DONE)
+    {
+      if(steps == MAX_STEPS) printf("maze %d: exploration did not end\n", maze);
+      failed++;
+      continue;
+    }
+    if(graphEnd == GRAPH_NONE)
+    {
+      printf("maze %d: finish not found\n", maze);
+      failed++;
+      continue;
+    }
+    if(graphNodes != nodes)
+    {
+      printf("maze %d: %d nodes for %d junctions\n", maze, graphNodes, nodes);
+      failed++;
+      continue;
+    }
+
+    /* Replay the path */
+    graphRoute();
+    v = START;
+    h = 0;
+    route = 0;
+    for(i = 0; ; i++)
+    {
+      v = drive(v, h, &units);
+      route += units;
+      if(v == finish || i >= pathLength) break;
+      h = (h + pathGet(i)) & 3;
+      if(link[v][h] < 0) break;
+    }
+    if(v != finish || i != pathLength)
+    {
+      printf("maze %d: replay failed, turn %d of %d\n", maze, i, pathLength);
+      failed++;
+      continue;
+    }
+    if(route != best)
+    {
+      printf("maze %d: route %d, shortest %d\n", maze, route, best);
+      failed++;
+      continue;
+    }
+    explored += (double) walked / best;
+  }
+
+  printf("%d mazes %dx%d with 1-4 loops, %d failed\n", MAZES, COLS, ROWS, failed);
+  if(failed < MAZES) printf("exploration drives %.2f x the shortest route on average\n", explored / (MAZES - failed));
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef HTC_H
+#define	HTC_H
+
+/***********************************
+ * Host stand-in for the compiler's
+ * <htc.h>, so ../main.c builds with
+ * gcc in maze_sim.c. Registers and pin
+ * bits are plain variables, maze_sim.c
+ * sets the sensor pins and reads the
+ * motor pins and PWM duty.
+ ***********************************/
+
+/***** Define *****/
+#define interrupt
+#define __delay_ms(x) ((void)(x))
+#define __delay_us(x) ((void)(x))
+
+/***** Registers *****/
+volatile unsigned char PORTA, PORTB, PORTC, PORTD, PORTE;
+volatile unsigned char TRISA, TRISB, TRISC, TRISD, TRISE, ANSEL, ANSELH;
+volatile unsigned char TMR0, PR2, T2CON, CCPR1L, CCPR2L, CCP1CON, CCP2CON;
+volatile unsigned char SPBRG, SPBRGH, TXREG, RCREG;
+
+/***** Bits *****/
+volatile unsigned char RA3, RA4, RA5, RB0, RB1, RB2, RB3, RB4, RB5, RB6, RB7;
+volatile unsigned char RC0, RC3, RC5, RD7, RE0, RE1, RE2;
+volatile unsigned char IRCF2, IRCF1, IRCF0, T0CS, PSA, PS2, PS1, PS0, T0IF, T0IE;
+volatile unsigned char GIE, PEIE, BRG16, BRGH, SPEN, CREN, TXEN, TX9, RX9;
+volatile unsigned char TXIF, TXIE, RCIF, RCIE, OERR;
+
+/***** Data EEPROM *****/
+unsigned char eepromData[256];
+
+unsigned char eeprom_read(unsigned char address)
+{
+  return eepromData[address];
+}
+
+void eeprom_write(unsigned char address, unsigned char data)
+{
+  eepromData[address] = data;
+}
+
+#endif
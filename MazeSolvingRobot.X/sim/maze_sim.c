@@ -0,0 +1,314 @@
+/*******************************************************
+ *  Title: Maze simulator for the maze solving robot
+ *  Build: make maze_sim, needs gcc
+ *  Usage: ./maze_sim [mazes] [seed]
+ *
+ *  Builds ../main.c as it is, against htc.h with pins as
+ *  variables. Each random tree maze (no loops) is drawn
+ *  as lines on a grid. The robot is simulated every 1ms:
+ *  sensor pins from the lines under the 5 sensors, then
+ *  the Timer0 interrupt and exploreStep(), then the
+ *  wheels from the motor pins and PWM duty. The reduced
+ *  path is replayed junction by junction on the grid.
+ *  Prints failures and averages for benchmarking.
+ *******************************************************/
+
+/***** Include files *****/
+#define main robotMain // main.c has the robot's main()
+#include "../main.c"
+#undef main
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/***** Define *****/
+#define COLS      5 // Grid junctions
+#define ROWS      5
+#define VERTS     (COLS * ROWS + 1) // Last one is the start, below column 0
+#define START     (VERTS - 1)
+#define CELL      250 // mm between grid junctions
+#define LINE_W    20 // mm, line width
+#define BOX       120 // mm, finish box side
+
+#define SENSOR_AHEAD 60 // mm, sensors in front of the wheel axle
+#define SENSOR_PITCH 15 // mm between sensors
+#define WHEEL_BASE   100 // mm
+#define V_MAX        1.0 // mm per ms at 100% duty
+#define TAU_DRIVE    40.0 // ms, motor time constants
+#define TAU_COAST    150.0
+#define TAU_BRAKE    15.0
+
+#define MAZES      1000
+#define EXPLORE_MS 600000UL // Give up after 10 minutes
+#define LOST_MS    5000 // No sensor on the line for this long
+
+/***** Global variable *****/
+int link[VERTS][4]; // Vertex through each heading (north, east, south, west), -1 if none
+int finish;
+double robotX, robotY, robotA; // Wheel axle centre mm, heading rad
+double speedL, speedR; // Wheel speed, mm per ms
+
+const int headX[4] = {0, 1, 0, -1};
+const int headY[4] = {1, 0, -1, 0};
+
+/***** Maze *****/
+double vertexX(int v)
+{
+  return (v == START) ? 0 : (v % COLS) * CELL;
+}
+
+double vertexY(int v)
+{
+  return (v == START) ? -CELL : (v / COLS) * CELL;
+}
+
+int vertex(int c, int r)
+{
+  if(c == 0 && r == -1) return START;
+  if(c < 0 || c >= COLS || r < 0 || r >= ROWS) return -1;
+  return r * COLS + c;
+}
+
+void connect(int a, int h, int b)
+{
+  link[a][h] = b;
+  link[b][(h + 2) & 3] = a;
+}
+
+void carve(int v, char *seen)
+{
+  int order[4] = {0, 1, 2, 3}, i, j, t, n;
+
+  seen[v] = 1;
+  for(i = 3; i > 0; i--) // Random order
+  {
+    j = rand() % (i + 1);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for(i = 0; i < 4; i++)
+  {
+    n = vertex(v % COLS + headX[order[i]], v / COLS + headY[order[i]]);
+    if(n >= 0 && n != START && !seen[n])
+    {
+      connect(v, order[i], n);
+      carve(n, seen);
+    }
+  }
+}
+
+int degree(int v)
+{
+  int h, n = 0;
+  for(h = 0; h < 4; h++) n += link[v][h] >= 0;
+  return n;
+}
+
+void generate(void)
+{
+  char seen[VERTS] = {0};
+  int v, h;
+
+  for(v = 0; v < VERTS; v++) for(h = 0; h < 4; h++) link[v][h] = -1;
+  carve(0, seen);
+  connect(START, 0, 0);
+  do finish = 1 + rand() % (COLS * ROWS - 1); // Finish box at a dead end
+  while(degree(finish) != 1);
+}
+
+/* Line or finish box under the point */
+int onLine(double x, double y)
+{
+  int v, u, h;
+  double half = LINE_W / 2.0;
+
+  if(fabs(x - vertexX(finish)) <= BOX / 2 && fabs(y - vertexY(finish)) <= BOX / 2) return 1;
+  v = vertex((int) floor(x / CELL + 0.5), (int) floor(y / CELL + 0.5)); // Nearest vertex
+  if(v < 0) return 0;
+  for(h = 0; h < 4; h++) // The point is on a line of the nearest vertex, if any
+  {
+    u = link[v][h];
+    if(u < 0) continue;
+    if(x >= fmin(vertexX(v), vertexX(u)) - half && x <= fmax(vertexX(v), vertexX(u)) + half &&
+       y >= fmin(vertexY(v), vertexY(u)) - half && y <= fmax(vertexY(v), vertexY(u)) + half) return 1;
+  }
+  return 0;
+}
+
+/***** Robot *****/
+/* Sensor pins from the lines, returns the sensor bits */
+uChar sense(void)
+{
+  const uChar bits[5] = {SEN_LEFT, SEN_MLEFT, SEN_MIDDLE, SEN_MRIGHT, SEN_RIGHT};
+  uChar i, sensor = 0;
+  double side, x, y;
+
+  for(i = 0; i < 5; i++)
+  {
+    side = (2 - i) * SENSOR_PITCH; // mm to the left
+    x = robotX + SENSOR_AHEAD * cos(robotA) - side * sin(robotA);
+    y = robotY + SENSOR_AHEAD * sin(robotA) + side * cos(robotA);
+    if(onLine(x, y)) sensor |= bits[i];
+  }
+  RA3 = (sensor & SEN_LEFT) != 0;
+  RA4 = (sensor & SEN_MLEFT) != 0;
+  RA5 = (sensor & SEN_MIDDLE) != 0;
+  RE0 = (sensor & SEN_MRIGHT) != 0;
+  RE1 = (sensor & SEN_RIGHT) != 0;
+  PORTA = RA3 << 3 | RA4 << 4 | RA5 << 5;
+  PORTE = RE0 | RE1 << 1;
+  return sensor;
+}
+
+/* Wheel speed after 1ms, L293 inputs a and b, enable duty 0 to 1. Equal
+ * inputs, 00 or 11, brake while enabled and coast in the PWM off time. */
+double wheel(double speed, uChar a, uChar b, double duty)
+{
+  if(a != b) return speed + ((b ? duty : -duty) * V_MAX - speed) / TAU_DRIVE;
+  return speed - speed * (duty / TAU_BRAKE + (1 - duty) / TAU_COAST);
+}
+
+void move(void)
+{
+  double dutyL, dutyR, speed;
+
+  dutyL = ((CCPR2L << 2) | ((CCP2CON >> 4) & 3)) / (4.0 * (PR2 + 1)); // PWM_RC1
+  dutyR = ((CCPR1L << 2) | ((CCP1CON >> 4) & 3)) / (4.0 * (PR2 + 1)); // PWM_RC2
+  speedL = wheel(speedL, (PORTB & MOTOR_LEFT_A) != 0, (PORTB & MOTOR_LEFT_B) != 0, dutyL);
+  speedR = wheel(speedR, (PORTB & MOTOR_RIGHT_A) != 0, (PORTB & MOTOR_RIGHT_B) != 0, dutyR);
+
+  speed = (speedL + speedR) / 2;
+  robotX += speed * cos(robotA);
+  robotY += speed * sin(robotA);
+  robotA += (speedR - speedL) / WHEEL_BASE;
+}
+
+/***** Replay *****/
+/* Drive from v along heading h to the next junction the sensors notice:
+ * a side branch, a corner, a dead end or the finish. */
+int drive(int v, int h, int *cells)
+{
+  *cells = 0;
+  while(1)
+  {
+    v = link[v][h];
+    (*cells)++;
+    if(v == finish) return v;
+    if(link[v][(h + 1) & 3] >= 0 || link[v][(h + 3) & 3] >= 0) return v;
+    if(link[v][h] < 0) return v; // Dead end
+  }
+}
+
+/* Drives the path, returns the cells to the finish, -1 if it goes wrong */
+int replay(int *junctions)
+{
+  int v = START, h = 0, cells, route = 0, i;
+
+  for(i = 0; ; i++)
+  {
+    v = drive(v, h, &cells);
+    route += cells;
+    if(v == finish || i >= pathLength) break;
+    h = (h + pathGet(i)) & 3;
+    if(link[v][h] < 0) return -1;
+  }
+  *junctions = i;
+  if(v != finish || i != pathLength) return -1;
+  return route;
+}
+
+/* Cells from start to finish, a tree has one route */
+int shortest(int v, int from, int cells)
+{
+  int h, n;
+
+  if(v == finish) return cells;
+  for(h = 0; h < 4; h++)
+  {
+    if(link[v][h] < 0 || link[v][h] == from) continue;
+    n = shortest(link[v][h], v, cells + 1);
+    if(n >= 0) return n;
+  }
+  return -1;
+}
+
+/***** Main function *****/
+int main(int argc, char **argv)
+{
+  int maze, mazes = MAZES, turns, junctions, route, failed = 0, pathMax = 0;
+  unsigned long t, lost;
+  uChar dir;
+  double sumMs = 0, sumJunction = 0, sumTurns = 0, sumPath = 0, sumReplay = 0, sumRoute = 0;
+  int done = 0;
+
+  if(argc > 1) mazes = atoi(argv[1]);
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+  pwmInit();
+  timerInit();
+
+  for(maze = 0; maze < mazes; maze++)
+  {
+    generate();
+    robotX = vertexX(START);
+    robotY = vertexY(START);
+    robotA = M_PI / 2;
+    speedL = speedR = 0;
+    motor(0, 0);
+
+    exploreStart();
+    turns = 0;
+    lost = 0;
+    for(t = 0; t < EXPLORE_MS && junctionState != JUNCTION_FINISH && junctionState != JUNCTION_LOST && lost < LOST_MS; t++)
+    {
+      if(sense()) lost = 0;
+      else lost++;
+      T0IF = 1;
+      isr();
+      dir = exploreStep(sensorRead());
+      if(dir)
+      {
+        exploreRecord(dir);
+        turns++;
+        if(pathLength > pathMax) pathMax = pathLength;
+      }
+      move();
+    }
+    exploreEnd();
+
+    if(junctionState != JUNCTION_FINISH)
+    {
+      printf("maze %d: %s after %lums, %d turns\n", maze, (junctionState == JUNCTION_LOST) ? "pivot gave up" : (lost < LOST_MS) ? "finish not found" : "line lost", t, turns);
+      failed++;
+      continue;
+    }
+    if(hypot(robotX - vertexX(finish), robotY - vertexY(finish)) > CELL / 2)
+    {
+      printf("maze %d: finish seen away from the finish box\n", maze);
+      failed++;
+      continue;
+    }
+    route = replay(&junctions);
+    if(route < 0 || route != shortest(START, -1, 0))
+    {
+      printf("maze %d: replay failed\n", maze);
+      failed++;
+      continue;
+    }
+
+    done++;
+    sumMs += t;
+    sumJunction += junctionTotal;
+    sumTurns += turns;
+    sumPath += pathLength;
+    sumReplay += junctions + 1;
+    sumRoute += route;
+  }
+
+  printf("%d mazes %dx%d, %d failed\n", mazes, COLS, ROWS, failed);
+  if(!done) return 1;
+  printf("exploration     %.0f ms, %.0f ms at junctions, %.1f turns\n", sumMs / done, sumJunction / done, sumTurns / done);
+  printf("reduced path    %.1f turns, buffer %d of %d turns at most\n", sumPath / done, pathMax, PATH_MAX);
+  printf("replay          %.1f segments, %.1f cells\n", sumReplay / done, sumRoute / done);
+  return failed ? 1 : 0;
+}
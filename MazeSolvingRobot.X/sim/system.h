@@ -0,0 +1,36 @@
+#ifndef SYSTEM_H
+#define	SYSTEM_H
+
+/***********************************
+ * Host stand-in for ../system.h, so
+ * maze.h and graph.h build with gcc.
+ * Defines SYSTEM_H first, the real
+ * system.h is skipped when maze.h
+ * includes it.
+ ***********************************/
+
+/***** Include files *****/
+#include <string.h>
+
+/***** Define *****/
+typedef unsigned char uChar;
+typedef unsigned short uInt; // 16-bit like XC8
+typedef unsigned long uLong;
+typedef signed char sChar;
+typedef signed short sInt;
+typedef signed long sLong;
+
+/***** Data EEPROM *****/
+static uChar eepromData[256];
+
+static uChar eeprom_read(uChar address)
+{
+  return eepromData[address];
+}
+
+static void eeprom_write(uChar address, uChar data)
+{
+  eepromData[address] = data;
+}
+
+#endif
@@ -7,17 +7,19 @@
 
 /***** Define *****/
 #define	_XTAL_FREQ  8000000
+#define TMR0_RELOAD (256 - _XTAL_FREQ / 4 / 8 / 1000) // 1ms at prescale 1:8
 
 #define SW1 RB0
 #define SW2 RB1
 
-#define BUZZER  RB7
 #define UARTRST RC0
 
-#define motorRightA RB2
-#define motorRightB RB3
-#define motorLeftA  RB4
-#define motorLeftB  RB5
+#define PORTB_BUZZER  0b10000000 // RB7, PORTB outputs are written with portbWrite()
+#define MOTOR_RIGHT_A 0b00000100 // RB2
+#define MOTOR_RIGHT_B 0b00001000 // RB3
+#define MOTOR_LEFT_A  0b00010000 // RB4
+#define MOTOR_LEFT_B  0b00100000 // RB5
+#define MOTOR_PINS    (MOTOR_RIGHT_A | MOTOR_RIGHT_B | MOTOR_LEFT_A | MOTOR_LEFT_B)
 
 #define senLeft   RA3
 #define senMLeft  RA4
@@ -26,9 +28,20 @@
 #define senRight  RE1
 #define senCal    RC5
 
-#define LCD_RS   RB6
+#define SEN_LEFT   0b10000 // Sensor bits returned by sensorRead()
+#define SEN_MLEFT  0b01000
+#define SEN_MIDDLE 0b00100
+#define SEN_MRIGHT 0b00010
+#define SEN_RIGHT  0b00001
+
+#define LCD_RS   0b01000000 // RB6, PORTB bit
 #define LCD_E    RE2
 #define LCD_DATA PORTD
+#define LCD_DATA_TRIS TRISD
+#define LCD_BUSY RD7
+//#define LCD_RW RC3 // Output pin to LCD R/W if connected, polls the busy flag
+
+//#define MAZE_LOOPED // Maze has loops, explore with graph.h instead of the left hand rule
 
 #define HEX     16
 #define DEC     10
@@ -0,0 +1,102 @@
+#ifndef TIMER_H
+#define	TIMER_H
+
+/***********************************
+ * timerInit();                // Timer0 every 1ms, enabled by GIE
+ * timerIsr();                 // From the interrupt, 1 if a ms passed
+ * start = timerNow();
+ * timerSince(start);          // ms since start, up to 65535
+ * timerWait(500);             // Wait 500ms on the tick
+ * timerSet(&timeout, 3000);   // Software timer, 3000ms from now
+ * timerDone(&timeout);        // 1 once it has run out
+ * timerNext(&lastTick);       // Wait for the next 1ms step
+ *
+ * All times are 16-bit ms, they wrap
+ * after 65.5s and the unsigned
+ * difference is still right for
+ * anything shorter. msTick is written
+ * by the interrupt, timerNow() reads
+ * both bytes with it held off.
+ ***********************************/
+
+/***** Include files *****/
+#include "system.h"
+
+/***** Define *****/
+#define TIMER_RAM 2 // Bytes of globals below
+
+/***** Timer function prototype *****/
+void timerInit(void);
+uChar timerIsr(void);
+uInt timerNow(void);
+uInt timerSince(uInt start);
+void timerWait(uInt ms);
+void timerSet(uInt *timer, uInt ms);
+uChar timerDone(uInt *timer);
+void timerNext(uChar *lastTick);
+
+/***** Global variable *****/
+volatile uInt msTick; // +1 every 1ms by Timer0
+
+/***** Timer sub function *****/
+void timerInit(void)
+{
+  T0CS = 0; // Timer0 clock = Fosc/4
+  PSA = 0; // Prescaler assigned to Timer0
+  PS2 = 0; // PS<2:0> = 010 => 1:8
+  PS1 = 1;
+  PS0 = 0;
+  TMR0 = TMR0_RELOAD;
+  T0IF = 0;
+  T0IE = 1; // Timer0 interrupt, enabled by GIE in main()
+}
+
+uChar timerIsr(void)
+{
+  if(!T0IE || !T0IF) return 0;
+  T0IF = 0;
+  TMR0 += TMR0_RELOAD;
+  msTick++;
+  return 1;
+}
+
+uInt timerNow(void)
+{
+  uInt now;
+
+  T0IE = 0; // msTick is two bytes, no carry between reading them
+  now = msTick;
+  T0IE = 1;
+  return now;
+}
+
+uInt timerSince(uInt start)
+{
+  return timerNow() - start;
+}
+
+void timerWait(uInt ms)
+{
+  uInt start = timerNow();
+  while(timerSince(start) < ms);
+}
+
+void timerSet(uInt *timer, uInt ms)
+{
+  *timer = timerNow() + ms;
+}
+
+uChar timerDone(uInt *timer)
+{
+  return (sInt) (timerNow() - *timer) >= 0;
+}
+
+/* Low byte only, one byte is read at once and steps are never
+ * 256ms apart. lastTick is the step that was run last. */
+void timerNext(uChar *lastTick)
+{
+  while(*lastTick == (uChar) msTick);
+  (*lastTick)++;
+}
+
+#endif
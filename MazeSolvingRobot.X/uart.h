@@ -1,45 +1,154 @@
 #ifndef UART_H
 #define	UART_H
 
+/***********************************
+ * uartInit();                // UART_BAUD, default 9600
+ * uartSend('A');              // 0 if TX buffer is full
+ * uartTryReceive(&data);      // 0 if nothing received
+ * uartReceiveTimeout(&data, 10); // 0 if nothing in 10ms, timer.h tick
+ * uartTransmit('A');          // Waits for space
+ * uartReceive();              // Waits for data
+ ***********************************/
+
 /***** Include Files *****/
 #include "system.h"
+#include "timer.h"
+
+/***** Define *****/
+#ifndef UART_BAUD
+#define UART_BAUD 9600 // Define before including uart.h to change
+#endif
+#define UART_MAX_ERROR 25 // Baudrate error limit in 0.1%
+
+// BRG16 = 1, BRGH = 1: baudrate = Fosc / (4 * (SPBRG + 1)), finest divisor
+// UART_BAUD * 1UL, a 16-bit int overflows at 9600 * 4
+#define UART_SPBRG_DIV(div) ((_XTAL_FREQ + UART_BAUD * 1UL * (div) / 2) / (UART_BAUD * 1UL * (div)) - 1)
+#if UART_SPBRG_DIV(4) <= 65535
+#define UART_BRGH 1
+#define UART_DIV  4
+#else
+#define UART_BRGH 0 // Very low baudrate, Fosc / (16 * (SPBRG + 1))
+#define UART_DIV  16
+#endif
+#define UART_SPBRG  UART_SPBRG_DIV(UART_DIV)
+#define UART_ACTUAL (_XTAL_FREQ / (UART_DIV * (UART_SPBRG + 1)))
+#define UART_ERROR  (((UART_ACTUAL > UART_BAUD) ? (UART_ACTUAL - UART_BAUD) : (UART_BAUD - UART_ACTUAL)) * 1000 / UART_BAUD)
+
+#if UART_SPBRG < 0 || UART_SPBRG > 65535
+#error "UART_BAUD is out of range for _XTAL_FREQ"
+#elif UART_ERROR > UART_MAX_ERROR
+#error "UART_BAUD error is too high for _XTAL_FREQ"
+#endif
+
+#define UART_RX_SIZE 16 // Ring buffer size, power of 2
+#define UART_TX_SIZE 16
+#define UART_RAM (UART_RX_SIZE + UART_TX_SIZE + 4) // Bytes of globals below
+
+#if (UART_RX_SIZE & (UART_RX_SIZE - 1)) || (UART_TX_SIZE & (UART_TX_SIZE - 1))
+#error "UART buffer size must be a power of 2"
+#endif
 
 /***** UART Function Prototype *****/
-void uartInit(uLong baudRate);
+void uartInit(void);
+uChar uartSend(uChar dataTx);
+uChar uartTryReceive(uChar *dataRx);
+uChar uartReceiveTimeout(uChar *dataRx, uInt timeoutMs);
 void uartTransmit(uChar dataTx);
 void uartPutstr(const char *s);
 uChar uartReceive(void);
 void uartNumber(uInt no, uChar base, uChar digit);
+void uartIsr(void);
 
 /***** Global Variable *****/
+volatile uChar uartRxBuffer[UART_RX_SIZE], uartTxBuffer[UART_TX_SIZE];
+volatile uChar uartRxHead, uartRxTail; // Head written by uartIsr()
+volatile uChar uartTxHead, uartTxTail; // Tail written by uartIsr()
 
 /***** Interrupt Function *****/
+void uartIsr(void)
+{
+  uChar next;
+
+  while(RCIF)
+  {
+    next = (uartRxHead + 1) & (UART_RX_SIZE - 1);
+    if(next != uartRxTail)
+    {
+      uartRxBuffer[uartRxHead] = RCREG;
+      uartRxHead = next;
+    }
+    else next = RCREG; // Buffer full, drop it
+    if(OERR)
+    {
+      CREN = 0;
+      CREN = 1;
+    }
+  }
+
+  if(TXIE && TXIF)
+  {
+    if(uartTxTail != uartTxHead)
+    {
+      TXREG = uartTxBuffer[uartTxTail];
+      uartTxTail = (uartTxTail + 1) & (UART_TX_SIZE - 1);
+    }
+    else TXIE = 0; // Nothing left to send
+  }
+}
 
 /***** UART Sub Function *****/
-void uartInit(uLong baudrate)
+void uartInit(void)
 {
   TXEN = 1; // Enable transmission
   TX9 = 0; // 8-bit transmission
   RX9 = 0; // 8-bit reception
   CREN = 1; // Enable reception
   SPEN = 1; // Enable serial port
+  uartRxHead = uartRxTail = 0;
+  uartTxHead = uartTxTail = 0;
+  RCIE = 1; // Receive interrupt, TXIE is set when there is data to send
+  PEIE = 1;
 
-  if(baudrate > 9000)
-  {
-    BRGH = 1; // Baudrate high speed option
-    SPBRG = (uInt) (((float) _XTAL_FREQ / (float) baudrate / 16.0) - 0.5);
-  }
-  else if(baudrate < 9000)
+  BRG16 = 1; // 16-bits baudrate generator
+  BRGH = UART_BRGH; // Selected at compile time, no floating point
+  SPBRGH = UART_SPBRG >> 8;
+  SPBRG = UART_SPBRG & 0xFF;
+}
+
+uChar uartSend(uChar dataTx)
+{
+  uChar next = (uartTxHead + 1) & (UART_TX_SIZE - 1);
+
+  if(next == uartTxTail) return 0; // Buffer full
+  uartTxBuffer[uartTxHead] = dataTx;
+  uartTxHead = next;
+  TXIE = 1;
+  return 1;
+}
+
+uChar uartTryReceive(uChar *dataRx)
+{
+  if(uartRxTail == uartRxHead) return 0; // Buffer empty
+  *dataRx = uartRxBuffer[uartRxTail];
+  uartRxTail = (uartRxTail + 1) & (UART_RX_SIZE - 1);
+  return 1;
+}
+
+uChar uartReceiveTimeout(uChar *dataRx, uInt timeoutMs)
+{
+  uInt timeout;
+
+  timerSet(&timeout, timeoutMs); // ms tick, not stretched by interrupt load
+  while(!uartTryReceive(dataRx))
   {
-    BRGH = 0; // Baudrate low speed option
-    SPBRG = (uInt) (((float) _XTAL_FREQ / (float) baudrate / 64.0) - 0.5);
+    if(timerDone(&timeout)) return 0;
   }
+  return 1;
 }
 
 void uartTransmit(uChar dataTx)
 {
-  while(!TXIF);
-  TXREG = dataTx;
+  while(!uartSend(dataTx));
 }
 
 void uartPutstr(const char *s)
@@ -49,13 +158,9 @@ void uartPutstr(const char *s)
 
 uChar uartReceive(void)
 {
-  if(OERR)
-  {
-    CREN = 0;
-    CREN = 1;
-  }
-  while(!RCIF);
-  return RCREG;
+  uChar dataRx;
+  while(!uartTryReceive(&dataRx));
+  return dataRx;
 }
 
 void uartNumber(uInt no, uChar base, uChar digit)